@@ -37,6 +37,7 @@
  */
 
 #include <assert.h>
+#include <stdio.h>
 #include <string.h>
 #include <math.h>
 #include <limits.h>
@@ -775,6 +776,47 @@ static int json_encode(lua_State *l)
     return 1;
 }
 
+/* Room reserved in front of an encoded frame for the
+ * "Content-Length: <n>\r\n\r\n" header */
+#define FRAME_HEADER_RESERVE 48
+
+/* encode_frame(value) => frame, len
+ *
+ * Encodes into the persistent encode buffer with room reserved at the
+ * front, then writes the Content-Length header right before the body.
+ * Returns a light userdata pointing at the start of the frame and its
+ * length. No Lua string is created; the frame stays valid until the next
+ * encode with this cjson instance. Requires encode_keep_buffer. */
+static int json_encode_frame(lua_State *l)
+{
+    json_config_t *cfg = json_fetch_config(l);
+    strbuf_t *encode_buf = &cfg->encode_buf;
+    char header[FRAME_HEADER_RESERVE];
+    char *json;
+    int len, hlen;
+
+    luaL_argcheck(l, lua_gettop(l) == 1, 1, "expected 1 argument");
+    if (!cfg->encode_keep_buffer)
+        return luaL_error(l, "encode_frame requires encode_keep_buffer");
+
+    strbuf_reset(encode_buf);
+    strbuf_ensure_empty_length(encode_buf, FRAME_HEADER_RESERVE);
+    strbuf_extend_length(encode_buf, FRAME_HEADER_RESERVE);
+
+    json_append_data(l, cfg, 0, encode_buf);
+    json = strbuf_string(encode_buf, &len);
+    len -= FRAME_HEADER_RESERVE;
+
+    hlen = snprintf(header, sizeof(header), "Content-Length: %d\r\n\r\n", len);
+    json += FRAME_HEADER_RESERVE - hlen;
+    memcpy(json, header, hlen);
+
+    lua_pushlightuserdata(l, json);
+    lua_pushinteger(l, hlen + len);
+
+    return 2;
+}
+
 /* ===== DECODING ===== */
 
 static void json_process_value(lua_State *l, json_parse_t *json,
@@ -1397,6 +1439,7 @@ static int lua_cjson_new(lua_State *l)
 {
     luaL_Reg reg[] = {
         { "encode", json_encode },
+        { "encode_frame", json_encode_frame },
         { "decode", json_decode },
         { "encode_sparse_array", json_cfg_encode_sparse_array },
         { "encode_max_depth", json_cfg_encode_max_depth },
@@ -798,5 +798,9 @@ void do_writeline(lua_State *L);
 #define lua_writestring do_writestring
 #define lua_writeline do_writeline
 
+// 额外空间用来保存调试器的线程信息(vscthread_t)
+#undef LUA_EXTRASPACE
+#define LUA_EXTRASPACE (10 * sizeof(void *))
+
 #endif
 
@@ -0,0 +1,383 @@
+/**
+ * 断点条件：在C层直接求值的简单条件
+ * by code
+ */
+#include "bpcond.h"
+#include <ctype.h>
+
+// 比较符
+#define OP_EQ 1         // ==
+#define OP_NE 2         // ~=
+#define OP_LT 3         // <
+#define OP_LE 4         // <=
+#define OP_GT 5         // >
+#define OP_GE 6         // >=
+#define OP_TRUTH 7      // 只有变量
+#define OP_NOT 8        // not 变量
+
+// 词法单元
+#define TK_EOF 0
+#define TK_ERROR 1
+#define TK_NAME 2
+#define TK_NUMBER 3
+#define TK_STRING 4
+#define TK_NIL 5
+#define TK_TRUE 6
+#define TK_FALSE 7
+#define TK_AND 8
+#define TK_OR 9
+#define TK_NOT 10
+#define TK_OP 11
+#define TK_MINUS 12
+
+typedef struct token {
+    int type;
+    int op;             // TK_OP的比较符
+    const char *p;      // 单元在源码里的位置
+    size_t len;
+} token_t;
+
+typedef struct lexer {
+    lua_State *dL;
+    const char *s;      // 当前位置
+    token_t tk;         // 当前单元
+} lexer_t;
+
+// 其他的关键字都不支持
+static const char *const RESERVED[] = {
+    "break", "do", "else", "elseif", "end", "for", "function", "goto", "if",
+    "in", "local", "repeat", "return", "then", "until", "while", NULL
+};
+
+static bool is_word(const char *p, size_t len, const char *word) {
+    return strlen(word) == len && memcmp(p, word, len) == 0;
+}
+
+static int name_token(const char *p, size_t len) {
+    int i;
+    if (is_word(p, len, "nil")) return TK_NIL;
+    if (is_word(p, len, "true")) return TK_TRUE;
+    if (is_word(p, len, "false")) return TK_FALSE;
+    if (is_word(p, len, "and")) return TK_AND;
+    if (is_word(p, len, "or")) return TK_OR;
+    if (is_word(p, len, "not")) return TK_NOT;
+    for (i = 0; RESERVED[i]; ++i) {
+        if (is_word(p, len, RESERVED[i])) return TK_ERROR;
+    }
+    return TK_NAME;
+}
+
+static void next_token(lexer_t *ls) {
+    const char *s = ls->s;
+    token_t *tk = &ls->tk;
+    while (isspace((unsigned char)*s)) s++;
+    tk->p = s;
+    tk->op = 0;
+    if (*s == '\0') {
+        tk->type = TK_EOF;
+    } else if (isalpha((unsigned char)*s) || *s == '_') {
+        while (isalnum((unsigned char)*s) || *s == '_') s++;
+        tk->type = name_token(tk->p, s - tk->p);
+    } else if (isdigit((unsigned char)*s) || (*s == '.' && isdigit((unsigned char)s[1]))) {
+        // 和Lua的词法一样，先把像数字的部分都读进来，再交给lua_stringtonumber检查
+        const char *expo = "Ee";
+        if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) expo = "Pp";
+        for (;;) {
+            if (*s && strchr(expo, *s) && (s[1] == '+' || s[1] == '-')) s += 2;
+            else if (isxdigit((unsigned char)*s) || *s == '.' || isalpha((unsigned char)*s)) s++;
+            else break;
+        }
+        tk->type = TK_NUMBER;
+    } else if (*s == '"' || *s == '\'') {
+        // 不支持转义字符
+        char quote = *s++;
+        while (*s && *s != quote && *s != '\\' && *s != '\n') s++;
+        if (*s == quote) {
+            s++;
+            tk->type = TK_STRING;
+        } else {
+            tk->type = TK_ERROR;
+        }
+    } else if (s[0] == '=' && s[1] == '=') {
+        s += 2; tk->type = TK_OP; tk->op = OP_EQ;
+    } else if (s[0] == '~' && s[1] == '=') {
+        s += 2; tk->type = TK_OP; tk->op = OP_NE;
+    } else if (s[0] == '<') {
+        tk->type = TK_OP;
+        tk->op = s[1] == '=' ? OP_LE : OP_LT;
+        s += s[1] == '=' ? 2 : 1;
+    } else if (s[0] == '>') {
+        tk->type = TK_OP;
+        tk->op = s[1] == '=' ? OP_GE : OP_GT;
+        s += s[1] == '=' ? 2 : 1;
+    } else if (s[0] == '-' && s[1] != '-') {
+        s++; tk->type = TK_MINUS;
+    } else {
+        tk->type = TK_ERROR;
+    }
+    tk->len = s - tk->p;
+    ls->s = s;
+}
+
+static char *copy_string(const char *p, size_t len) {
+    char *s = malloc(len + 1);
+    memcpy(s, p, len);
+    s[len] = '\0';
+    return s;
+}
+
+// 常量：nil, true, false, 数字, 字符串
+static bool parse_const(lexer_t *ls, bpcmp_t *c) {
+    token_t *tk = &ls->tk;
+    bool minus = false;
+    if (tk->type == TK_MINUS) {
+        minus = true;
+        next_token(ls);
+        if (tk->type != TK_NUMBER) return false;
+    }
+    switch (tk->type) {
+    case TK_NIL:
+        c->type = LUA_TNIL;
+        break;
+    case TK_TRUE:
+    case TK_FALSE:
+        c->type = LUA_TBOOLEAN;
+        c->b = tk->type == TK_TRUE;
+        break;
+    case TK_STRING:
+        c->type = LUA_TSTRING;
+        c->len = tk->len - 2;
+        c->s = copy_string(tk->p + 1, c->len);
+        break;
+    case TK_NUMBER: {
+        char buf[64];
+        if (tk->len + 2 > sizeof(buf)) return false;
+        buf[0] = '-';
+        memcpy(buf + 1, tk->p, tk->len);
+        buf[tk->len + 1] = '\0';
+        if (!lua_stringtonumber(ls->dL, minus ? buf : buf + 1)) return false;
+        c->type = LUA_TNUMBER;
+        c->isint = lua_isinteger(ls->dL, -1);
+        c->i = lua_tointeger(ls->dL, -1);
+        c->n = lua_tonumber(ls->dL, -1);
+        lua_pop(ls->dL, 1);
+        break;
+    }
+    default:
+        return false;
+    }
+    next_token(ls);
+    return true;
+}
+
+static bool is_const(token_t *tk) {
+    return tk->type == TK_NIL || tk->type == TK_TRUE || tk->type == TK_FALSE ||
+        tk->type == TK_STRING || tk->type == TK_NUMBER || tk->type == TK_MINUS;
+}
+
+// 一个比较：变量 op 常量 | 常量 op 变量 | 变量 | not 变量
+static bool parse_cmp(lexer_t *ls, bpcmp_t *c) {
+    token_t *tk = &ls->tk;
+    if (tk->type == TK_NOT) {
+        next_token(ls);
+        if (tk->type != TK_NAME) return false;
+        c->name = copy_string(tk->p, tk->len);
+        c->op = OP_NOT;
+        next_token(ls);
+        // not a == b 是 (not a) == b，不支持
+        return tk->type != TK_OP;
+    } else if (tk->type == TK_NAME) {
+        c->name = copy_string(tk->p, tk->len);
+        next_token(ls);
+        if (tk->type != TK_OP) {
+            c->op = OP_TRUTH;
+            return true;
+        }
+        c->op = tk->op;
+        next_token(ls);
+        return parse_const(ls, c);
+    } else if (is_const(tk)) {
+        if (!parse_const(ls, c) || tk->type != TK_OP) return false;
+        // 常量在左边，比较方向反过来
+        static const int swapop[] = {0, OP_EQ, OP_NE, OP_GT, OP_GE, OP_LT, OP_LE};
+        c->op = swapop[tk->op];
+        next_token(ls);
+        if (tk->type != TK_NAME) return false;
+        c->name = copy_string(tk->p, tk->len);
+        next_token(ls);
+        return true;
+    }
+    return false;
+}
+
+bpcond_t *bpcond_parse(lua_State *dL, const char *src) {
+    lexer_t ls;
+    ls.dL = dL;
+    ls.s = src;
+    next_token(&ls);
+
+    bpcond_t *cond = malloc(sizeof(bpcond_t));
+    cond->n = 0;
+    cond->cmps = NULL;
+    int cap = 0;
+    bool orbefore = false;
+    for (;;) {
+        if (cond->n >= cap) {
+            cap = cap ? cap * 2 : 4;
+            cond->cmps = realloc(cond->cmps, cap * sizeof(bpcmp_t));
+        }
+        bpcmp_t *c = &cond->cmps[cond->n++];
+        memset(c, 0, sizeof(bpcmp_t));
+        c->orbefore = orbefore;
+        if (!parse_cmp(&ls, c)) break;
+        if (ls.tk.type == TK_EOF) return cond;
+        if (ls.tk.type != TK_AND && ls.tk.type != TK_OR) break;
+        orbefore = ls.tk.type == TK_OR;
+        next_token(&ls);
+    }
+    bpcond_free(cond);
+    return NULL;
+}
+
+void bpcond_free(bpcond_t *cond) {
+    int i;
+    if (!cond) return;
+    for (i = 0; i < cond->n; ++i) {
+        free(cond->cmps[i].name);
+        free(cond->cmps[i].s);
+    }
+    free(cond->cmps);
+    free(cond);
+}
+
+// 把slot位置的变量压到栈上，名字对不上返回false
+static bool push_slot(bpcmp_t *c, lua_State *L, lua_Debug *ar, int slot) {
+    const char *name;
+    if (slot > 0) {
+        name = lua_getlocal(L, ar, slot);    // <v>
+        if (!name) return false;
+    } else {
+        lua_getinfo(L, "f", ar);            // <f>
+        name = lua_getupvalue(L, -1, -slot);    // <f|v>
+        lua_remove(L, -2);                  // <v>
+        if (!name) {
+            lua_pop(L, 1);
+            return false;
+        }
+    }
+    if (strcmp(name, c->name) == 0) return true;
+    lua_pop(L, 1);
+    return false;
+}
+
+// 把变量压到栈上，变量的位置缓存起来，同一个原型里下次直接取
+static bool push_var(bpcmp_t *c, lua_State *L, lua_Debug *ar, const Proto *p) {
+    if (c->p == p && c->slot && push_slot(c, L, ar, c->slot))
+        return true;
+
+    // 同名的局部变量后面的有效，然后才是上值，都找不到就是全局变量
+    int slot = 0, i;
+    const char *name;
+    for (i = 1; (name = lua_getlocal(L, ar, i)) != NULL; ++i) {
+        lua_pop(L, 1);
+        if (strcmp(name, c->name) == 0) slot = i;
+    }
+    for (i = 0; !slot && i < p->sizeupvalues; ++i) {
+        TString *uvname = p->upvalues[i].name;
+        if (uvname && strcmp(getstr(uvname), c->name) == 0) slot = -(i + 1);
+    }
+    c->p = p;
+    c->slot = slot;
+    return slot && push_slot(c, L, ar, slot);
+}
+
+static void push_const(bpcmp_t *c, lua_State *L) {
+    if (c->type == LUA_TNUMBER) {
+        if (c->isint) lua_pushinteger(L, c->i);
+        else lua_pushnumber(L, c->n);
+    } else {
+        lua_pushlstring(L, c->s, c->len);
+    }
+}
+
+// 变量在栈顶，和常量比较是否相等
+static bool equal_const(bpcmp_t *c, lua_State *L) {
+    int t = lua_type(L, -1);
+    if (t != c->type) return false;
+    switch (t) {
+    case LUA_TNIL:
+        return true;
+    case LUA_TBOOLEAN:
+        return lua_toboolean(L, -1) == c->b;
+    case LUA_TSTRING: {
+        size_t len;
+        const char *s = lua_tolstring(L, -1, &len);
+        return len == c->len && memcmp(s, c->s, len) == 0;
+    }
+    case LUA_TNUMBER: {
+        if (c->isint && lua_isinteger(L, -1))
+            return lua_tointeger(L, -1) == c->i;
+        push_const(c, L);
+        bool eq = lua_rawequal(L, -2, -1);
+        lua_pop(L, 1);
+        return eq;
+    }
+    }
+    return false;
+}
+
+static int eval_cmp(bpcmp_t *c, lua_State *L, lua_Debug *ar, const Proto *p) {
+    if (!push_var(c, L, ar, p))     // <v>
+        return BPCOND_FALLBACK;
+    int r;
+    switch (c->op) {
+    case OP_TRUTH:
+        r = lua_toboolean(L, -1);
+        break;
+    case OP_NOT:
+        r = !lua_toboolean(L, -1);
+        break;
+    case OP_EQ:
+        r = equal_const(c, L);
+        break;
+    case OP_NE:
+        r = !equal_const(c, L);
+        break;
+    default: {
+        // 只有数字和数字、字符串和字符串能比较大小，其他的脚本里会报错
+        int t = lua_type(L, -1);
+        if (t != c->type || (t != LUA_TNUMBER && t != LUA_TSTRING)) {
+            lua_pop(L, 1);
+            return BPCOND_ERROR;
+        }
+        push_const(c, L);   // <v|k>
+        if (c->op == OP_LT) r = lua_compare(L, -2, -1, LUA_OPLT);
+        else if (c->op == OP_LE) r = lua_compare(L, -2, -1, LUA_OPLE);
+        else if (c->op == OP_GT) r = lua_compare(L, -1, -2, LUA_OPLT);
+        else r = lua_compare(L, -1, -2, LUA_OPLE);
+        lua_pop(L, 1);      // <v>
+        break;
+    }
+    }
+    lua_pop(L, 1);  // <>
+    return r ? BPCOND_TRUE : BPCOND_FALSE;
+}
+
+// 按Lua的短路规则求值：and的优先级比or高
+int bpcond_eval(bpcond_t *cond, lua_State *L, lua_Debug *ar, const Proto *p) {
+    bool group = true;
+    int i;
+    for (i = 0; i < cond->n; ++i) {
+        bpcmp_t *c = &cond->cmps[i];
+        if (c->orbefore) {
+            if (group) return BPCOND_TRUE;
+            group = true;
+        }
+        if (group) {
+            int r = eval_cmp(c, L, ar, p);
+            if (r == BPCOND_ERROR || r == BPCOND_FALLBACK) return r;
+            group = r == BPCOND_TRUE;
+        }
+    }
+    return group ? BPCOND_TRUE : BPCOND_FALSE;
+}
@@ -0,0 +1,44 @@
+/**
+ * 断点条件：在C层直接求值的简单条件
+ * 只支持 变量 比较符 常量，以及用and/or连接起来的这种比较，其他的交给调试器脚本编译求值
+ * by code
+ */
+#ifndef __BPCOND_H__
+#define __BPCOND_H__
+#include "defines.h"
+#include "lobject.h"
+
+// 求值结果
+#define BPCOND_FALSE 0          // 条件不成立
+#define BPCOND_TRUE 1           // 条件成立
+#define BPCOND_ERROR 2          // 求值出错，和脚本一样当作成立
+#define BPCOND_FALLBACK 3       // C层求不了值，交给调试器脚本
+
+// 条件里的一个比较：变量 op 常量
+typedef struct bpcmp {
+    char *name;                 // 变量名，局部变量或上值
+    int op;                     // 比较符
+    int type;                   // 常量的类型
+    bool orbefore;              // 和前一个比较是不是用or连接
+    bool isint;                 // 数字常量是不是整数
+    lua_Integer i;              // 常量的值
+    lua_Number n;
+    bool b;
+    char *s;
+    size_t len;
+    const Proto *p;             // 最近一次找到变量的原型
+    int slot;                   // 变量的位置：>0为局部变量索引，<0为上值索引
+} bpcmp_t;
+
+typedef struct bpcond {
+    int n;                      // 比较的数量
+    bpcmp_t *cmps;
+} bpcond_t;
+
+// 解析条件，不支持的条件返回NULL；dL只用来转换数字
+bpcond_t *bpcond_parse(lua_State *dL, const char *src);
+void bpcond_free(bpcond_t *cond);
+// 在栈帧ar上求值，ar必须是Lua函数的栈帧
+int bpcond_eval(bpcond_t *cond, lua_State *L, lua_Debug *ar, const Proto *p);
+
+#endif // __BPCOND_H__
@@ -0,0 +1,282 @@
+/**
+ * 断点索引：源ID -> 行号位图
+ * by code
+ */
+#include "breakpoint.h"
+#include <limits.h>
+#include <ctype.h>
+
+#define BPTABLE_MINSIZE 16
+#define BPPROTO_MINSIZE 64
+
+static void free_line(bpline_t *bl) {
+    bpcond_free(bl->cond);
+    free(bl->condsrc);
+    free(bl->logmsg);
+}
+
+static void free_source(bpsource_t *bs) {
+    int i;
+    if (!bs) return;
+    for (i = 0; i < bs->nbps; ++i)
+        free_line(&bs->bps[i]);
+    free(bs->bps);
+    free(bs->lines);
+    free(bs);
+}
+
+static int compare_line(const void *a, const void *b) {
+    return ((const bpline_t*)a)->line - ((const bpline_t*)b)->line;
+}
+
+static int count_lines(bpsource_t *bs) {
+    int n = 0, i;
+    for (i = 0; i <= bs->maxline; ++i) {
+        if (bs->lines[i >> 3] & (1 << (i & 7))) n++;
+    }
+    return n;
+}
+
+static bpsource_t *get_source(bptable_t *bt, int srcid) {
+    return srcid > 0 && srcid < bt->size ? bt->sources[srcid] : NULL;
+}
+
+// 清空原型缓存，断点改变后所有原型都要重新计算
+static void clear_protos(bptable_t *bt) {
+    int i;
+    for (i = 0; i < bt->psize; ++i) {
+        free(bt->protos[i].lines);
+        bt->protos[i].lines = NULL;
+        bt->protos[i].p = NULL;
+    }
+    bt->pcount = 0;
+    bt->plast = NULL;
+}
+
+static unsigned int hash_proto(const Proto *p) {
+    size_t h = (size_t)p;
+    return (unsigned int)((h >> 3) ^ (h >> 17)) * 2654435761u;
+}
+
+static bpproto_t *find_proto_slot(bpproto_t *protos, int psize, const Proto *p) {
+    unsigned int i = hash_proto(p) & (psize - 1);
+    while (protos[i].p && protos[i].p != p)
+        i = (i + 1) & (psize - 1);
+    return &protos[i];
+}
+
+static void resize_protos(bptable_t *bt, int psize) {
+    bpproto_t *protos = calloc(psize, sizeof(bpproto_t));
+    int i;
+    for (i = 0; i < bt->psize; ++i) {
+        if (bt->protos[i].p)
+            *find_proto_slot(protos, psize, bt->protos[i].p) = bt->protos[i];
+    }
+    free(bt->protos);
+    bt->protos = protos;
+    bt->psize = psize;
+    bt->plast = NULL;
+}
+
+// 根据原型的行信息计算出它的断点位图
+static void build_proto(bptable_t *bt, bpproto_t *bp, const Proto *p) {
+    free(bp->lines);
+    bp->p = p;
+    bp->srcid = srctable_getid(bt->srcs, p->source);
+    bp->source = p->source;
+    bp->linedefined = p->linedefined;
+    bp->lastlinedefined = p->lastlinedefined;
+    bp->sizelineinfo = p->sizelineinfo;
+    bp->firstline = bp->lastline = 0;
+    bp->lines = NULL;
+    if (!bt->nlines || !p->lineinfo) return;
+
+    bpsource_t *bs = get_source(bt, bp->srcid);
+    if (!bs) return;
+
+    int i, first = 0, last = 0;
+    for (i = 0; i < p->sizelineinfo; ++i) {
+        int line = p->lineinfo[i];
+        if (line > 0 && line <= bs->maxline && (bs->lines[line >> 3] & (1 << (line & 7)))) {
+            if (!first || line < first) first = line;
+            if (line > last) last = line;
+        }
+    }
+    if (!first) return;
+
+    bp->firstline = first;
+    bp->lastline = last;
+    bp->lines = calloc(((last - first) >> 3) + 1, 1);
+    for (i = 0; i < p->sizelineinfo; ++i) {
+        int line = p->lineinfo[i];
+        if (line >= first && line <= last && (bs->lines[line >> 3] & (1 << (line & 7))))
+            bp->lines[(line - first) >> 3] |= 1 << ((line - first) & 7);
+    }
+}
+
+void bptable_init(bptable_t *bt, srctable_t *srcs) {
+    memset(bt, 0, sizeof(bptable_t));
+    bt->srcs = srcs;
+}
+
+void bptable_free(bptable_t *bt) {
+    int i;
+    for (i = 0; i < bt->size; ++i)
+        free_source(bt->sources[i]);
+    free(bt->sources);
+    clear_protos(bt);
+    free(bt->protos);
+    memset(bt, 0, sizeof(bptable_t));
+}
+
+void bptable_set(bptable_t *bt, int srcid, const bpline_t *bps, int n) {
+    int i;
+    if (srcid <= 0) {
+        for (i = 0; i < n; ++i)
+            free_line((bpline_t*)&bps[i]);
+        return;
+    }
+    clear_protos(bt);
+    bpsource_t *bs = get_source(bt, srcid);
+    if (bs) {
+        bt->nlines -= count_lines(bs);
+        free_source(bs);
+        bt->sources[srcid] = NULL;
+    }
+    if (n <= 0) return;
+
+    bs = malloc(sizeof(bpsource_t));
+    bs->bps = malloc(sizeof(bpline_t) * n);
+    bs->nbps = 0;
+    bs->maxline = 0;
+    for (i = 0; i < n; ++i) {
+        if (bps[i].line > 0) {
+            bs->bps[bs->nbps++] = bps[i];
+            if (bps[i].line > bs->maxline) bs->maxline = bps[i].line;
+        } else {
+            free_line((bpline_t*)&bps[i]);
+        }
+    }
+    if (bs->maxline <= 0) {
+        bs->lines = NULL;
+        free_source(bs);
+        return;
+    }
+    qsort(bs->bps, bs->nbps, sizeof(bpline_t), compare_line);
+    bs->lines = calloc((bs->maxline >> 3) + 1, 1);
+    for (i = 0; i < bs->nbps; ++i)
+        bs->lines[bs->bps[i].line >> 3] |= 1 << (bs->bps[i].line & 7);
+
+    if (srcid >= bt->size) {
+        int size = bt->size ? bt->size : BPTABLE_MINSIZE;
+        while (size <= srcid) size *= 2;
+        bt->sources = realloc(bt->sources, size * sizeof(bpsource_t*));
+        memset(bt->sources + bt->size, 0, (size - bt->size) * sizeof(bpsource_t*));
+        bt->size = size;
+    }
+    bt->sources[srcid] = bs;
+    bt->nlines += count_lines(bs);
+}
+
+bool bptable_test(bptable_t *bt, int srcid, int line) {
+    if (!bt->nlines || line <= 0) return false;
+    bpsource_t *bs = get_source(bt, srcid);
+    if (!bs || line > bs->maxline) return false;
+    return (bs->lines[line >> 3] & (1 << (line & 7))) != 0;
+}
+
+bpline_t *bptable_getline(bptable_t *bt, int srcid, int line) {
+    bpsource_t *bs = get_source(bt, srcid);
+    if (!bs) return NULL;
+    int lo = 0, hi = bs->nbps - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (bs->bps[mid].line == line) return &bs->bps[mid];
+        if (bs->bps[mid].line < line) lo = mid + 1;
+        else hi = mid - 1;
+    }
+    return NULL;
+}
+
+const bpproto_t *bptable_getproto(bptable_t *bt, const Proto *p) {
+    bpproto_t *bp = bt->plast;
+    if (!bp || bp->p != p) {
+        if (bt->pcount * 2 >= bt->psize)
+            resize_protos(bt, bt->psize ? bt->psize * 2 : BPPROTO_MINSIZE);
+        bp = find_proto_slot(bt->protos, bt->psize, p);
+        if (!bp->p) {
+            bt->pcount++;
+            build_proto(bt, bp, p);
+        }
+        bt->plast = bp;
+    }
+    // 原型被回收后地址可能被新的原型复用
+    if (bp->source != p->source || bp->linedefined != p->linedefined ||
+        bp->lastlinedefined != p->lastlinedefined || bp->sizelineinfo != p->sizelineinfo)
+        build_proto(bt, bp, p);
+    return bp;
+}
+
+bool bptable_testproto(bptable_t *bt, const Proto *p, int line) {
+    if (!bt->nlines) return false;
+    const bpproto_t *bp = bptable_getproto(bt, p);
+    if (!bp->lines || line < bp->firstline || line > bp->lastline) return false;
+    line -= bp->firstline;
+    return (bp->lines[line >> 3] & (1 << (line & 7))) != 0;
+}
+
+void bpline_parsehit(bpline_t *bl, const char *expr) {
+    bl->hitop = BPHIT_NONE;
+    bl->hitcount = 0;
+    bl->hits = 0;
+    if (!expr) return;
+
+    while (isspace((unsigned char)*expr)) expr++;
+    int op = BPHIT_SKIP;
+    if (expr[0] == '=' && expr[1] == '=') op = BPHIT_EQ, expr += 2;
+    else if (expr[0] == '>' && expr[1] == '=') op = BPHIT_GE, expr += 2;
+    else if (expr[0] == '<' && expr[1] == '=') op = BPHIT_LE, expr += 2;
+    else if (expr[0] == '>') op = BPHIT_GT, expr++;
+    else if (expr[0] == '<') op = BPHIT_LT, expr++;
+    else if (expr[0] == '%') op = BPHIT_MOD, expr++;
+
+    char *end;
+    long n = strtol(expr, &end, 10);
+    if (end == expr) return;
+    while (isspace((unsigned char)*end)) end++;
+    if (*end || n < 0 || n >= INT_MAX || (op == BPHIT_MOD && n == 0)) return;
+    bl->hitop = op;
+    bl->hitcount = (int)n;
+}
+
+bool bpline_hit(bpline_t *bl) {
+    switch (bl->hitop) {
+    case BPHIT_NONE:
+        return true;
+    case BPHIT_SKIP:
+        if (++bl->hits <= bl->hitcount) return false;
+        bl->hits = 0;
+        return true;
+    case BPHIT_MOD:
+        if (++bl->hits < bl->hitcount) return false;
+        bl->hits = 0;
+        return true;
+    }
+    // 比较只关心有没有超过N，超过后不再计数，长时间运行的服务里计数也不会溢出
+    if (bl->hits <= bl->hitcount) bl->hits++;
+    int n = bl->hits;
+    switch (bl->hitop) {
+    case BPHIT_EQ:
+        return n == bl->hitcount;
+    case BPHIT_GT:
+        return n > bl->hitcount;
+    case BPHIT_GE:
+        return n >= bl->hitcount;
+    case BPHIT_LT:
+        return n < bl->hitcount;
+    case BPHIT_LE:
+        return n <= bl->hitcount;
+    default:
+        return true;
+    }
+}
@@ -0,0 +1,86 @@
+/**
+ * 断点索引：源ID -> 行号位图
+ * by code
+ */
+#ifndef __BREAKPOINT_H__
+#define __BREAKPOINT_H__
+#include "defines.h"
+#include "lobject.h"
+#include "srctable.h"
+#include "bpcond.h"
+
+// 命中次数条件
+#define BPHIT_NONE 0            // 没有
+#define BPHIT_SKIP 1            // N：跳过N次，第N+1次停下后重新计数
+#define BPHIT_EQ 2              // == N
+#define BPHIT_GT 3              // > N
+#define BPHIT_GE 4              // >= N
+#define BPHIT_LT 5              // < N
+#define BPHIT_LE 6              // <= N
+#define BPHIT_MOD 7             // % N：每N次停一次
+
+// 一个断点
+typedef struct bpline {
+    int line;                   // 行号
+    bpcond_t *cond;             // 能在C层求值的条件，NULL表示没有条件或C层求不了
+    char *condsrc;              // 条件的源码，C层求不了时交给被调试虚拟机编译求值
+    int hitop;                  // 命中次数条件
+    int hitcount;               // 命中次数条件的N
+    int hits;                   // 条件成立的次数，超过N后不再增加；N和% N的计数满了归零
+    char *logmsg;               // 日志断点的消息，NULL表示普通断点
+} bpline_t;
+
+// 一个源文件的断点行
+typedef struct bpsource {
+    int maxline;                // 位图能表示的最大行号
+    unsigned char *lines;       // 行号位图
+    bpline_t *bps;              // 断点，按行号排序
+    int nbps;
+} bpsource_t;
+
+// 函数原型的断点缓存：原型代码里出现过的断点行
+typedef struct bpproto {
+    const Proto *p;             // 函数原型，NULL表示空槽
+    int srcid;                  // 原型所在源文件的源ID，0表示不是文件
+    const TString *source;      // 以下几项用于校验原型地址是否被复用
+    int linedefined;
+    int lastlinedefined;
+    int sizelineinfo;
+    int firstline;              // 位图的起始行
+    int lastline;               // 位图的结束行
+    unsigned char *lines;       // 断点行位图，NULL表示函数内没有断点
+} bpproto_t;
+
+// 断点表
+typedef struct bptable {
+    srctable_t *srcs;           // 源文件表
+    bpsource_t **sources;       // 以源ID为下标的断点行，NULL表示没有断点
+    int size;                   // 数组容量
+    int nlines;                 // 所有源文件的断点总数
+    bpproto_t *protos;          // 原型缓存，开放寻址
+    int psize;                  // 原型缓存的容量，总是2的幂
+    int pcount;                 // 原型缓存的数量
+    bpproto_t *plast;           // 最近一次查询的原型
+} bptable_t;
+
+void bptable_init(bptable_t *bt, srctable_t *srcs);
+void bptable_free(bptable_t *bt);
+
+// 设置某个源文件的断点，会替换掉该文件原来的断点，n为0表示清除，断点的条件交给断点表释放
+void bptable_set(bptable_t *bt, int srcid, const bpline_t *bps, int n);
+// 检查某个源文件的某一行是否有断点
+bool bptable_test(bptable_t *bt, int srcid, int line);
+// 取某个源文件某一行的断点，没有返回NULL
+bpline_t *bptable_getline(bptable_t *bt, int srcid, int line);
+
+// 解析命中次数条件：N，== N，> N，>= N，< N，<= N，% N，解析不了当作没有
+void bpline_parsehit(bpline_t *bl, const char *expr);
+// 条件成立时计一次数，返回是否满足命中次数条件
+bool bpline_hit(bpline_t *bl);
+
+// 取函数原型的断点缓存，缓存在bptable_set时失效，原型的源ID总是有效
+const bpproto_t *bptable_getproto(bptable_t *bt, const Proto *p);
+// 函数原型的某一行是否有断点
+bool bptable_testproto(bptable_t *bt, const Proto *p, int line);
+
+#endif // __BREAKPOINT_H__
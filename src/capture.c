@@ -0,0 +1,262 @@
+/**
+ * 捕获标准输出和标准错误
+ * by code
+ */
+#include "capture.h"
+#include "dapjson.h"
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+
+static const char *CATEGORIES[CAPTURE_NFD] = {"stdout", "stderr"};
+
+void capture_init(capture_t *cap) {
+    memset(cap, 0, sizeof(capture_t));
+    outbuf_init(&cap->json);
+    int i;
+    for (i = 0; i < CAPTURE_NFD; ++i)
+        cap->rfds[i] = cap->savedfds[i] = -1;
+    cap->wakefds[0] = cap->wakefds[1] = -1;
+    cap->spillfd = -1;
+}
+
+void capture_set_policy(capture_t *cap, bool skip, const char *spillpath) {
+    if (cap->started) pthread_mutex_lock(&cap->mutex);
+    if (cap->spillfd >= 0 && (!spillpath || !cap->spillpath || strcmp(cap->spillpath, spillpath) != 0)) {
+        close(cap->spillfd);
+        cap->spillfd = -1;
+    }
+    free(cap->spillpath);
+    cap->spillpath = spillpath ? strdup(spillpath) : NULL;
+    cap->skip = skip;
+    if (cap->started) pthread_mutex_unlock(&cap->mutex);
+}
+
+// 末尾不完整的UTF-8字符的起始位置，完整时返回len
+static size_t utf8_complete(const char *s, size_t len) {
+    size_t i = len, n = 0;
+    while (i > 0 && n < 4) {
+        unsigned char c = s[--i];
+        n++;
+        if ((c & 0xC0) != 0x80) {
+            size_t need = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+            return n < need ? i : len;
+        }
+    }
+    return len;
+}
+
+// 把内容编码成一个output事件放进写队列
+static void post_output(capture_t *cap, const char *category, const char *s, size_t len) {
+    outbuf_t *ob = &cap->json;
+    outbuf_clear(ob, 0);
+    dapjson_event(ob, vscio_next_seq(cap->io), "output");
+    dapjson_lit(ob, "{\"category\":");
+    dapjson_string(ob, category, strlen(category));
+    dapjson_lit(ob, ",\"output\":");
+    dapjson_string(ob, s, len);
+    dapjson_lit(ob, "}");
+    dapjson_end(ob);
+    vscio_post(cap->io, ob->buf, ob->len);
+}
+
+// 写队列又有空间了，报告之前丢掉或转存了多少字节，调用前要锁住
+static void report_skipped(capture_t *cap) {
+    char msg[1024];
+    if (cap->dropped) {
+        snprintf(msg, sizeof(msg), "[%zu bytes of stdout/stderr dropped: the client was not reading output fast enough]\n",
+            cap->dropped);
+        cap->dropped = 0;
+        post_output(cap, "console", msg, strlen(msg));
+    }
+    if (cap->spilled) {
+        snprintf(msg, sizeof(msg), "[%zu bytes of stdout/stderr written to %s: the client was not reading output fast enough]\n",
+            cap->spilled, cap->spillpath ? cap->spillpath : "");
+        cap->spilled = 0;
+        post_output(cap, "console", msg, strlen(msg));
+    }
+}
+
+static bool write_all(int fd, const char *s, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, s, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        s += n;
+        len -= n;
+    }
+    return true;
+}
+
+// 写队列满了时按策略处理，返回true表示不用再发给客户端，调用前要锁住
+static bool skip_output(capture_t *cap, const char *s, size_t len) {
+    if (!cap->skip)
+        return false;
+    if (!vscio_wfull(cap->io)) {
+        if (cap->dropped || cap->spilled) report_skipped(cap);
+        return false;
+    }
+    if (cap->spillpath && cap->spillfd < 0) {
+        cap->spillfd = open(cap->spillpath, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (cap->spillfd < 0) {
+            free(cap->spillpath);
+            cap->spillpath = NULL;
+        }
+    }
+    if (cap->spillfd >= 0 && write_all(cap->spillfd, s, len))
+        cap->spilled += len;
+    else
+        cap->dropped += len;
+    return true;
+}
+
+// 读完管道里已有的内容，调用前要锁住
+static void read_pipe(capture_t *cap, int idx) {
+    for (;;) {
+        int fd = cap->rfds[idx];
+        if (fd < 0) return;
+        int np = cap->npend[idx];
+        memcpy(cap->buf, cap->pend[idx], np);
+        ssize_t n = read(fd, cap->buf + np, CAPTURE_BUFSIZE);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            if (n == 0) {
+                // 写端都关了，比如脚本关掉了io.stdout
+                close(fd);
+                cap->rfds[idx] = -1;
+            }
+            return;
+        }
+        size_t len = np + n;
+        size_t end = utf8_complete(cap->buf, len);
+        cap->npend[idx] = len - end;
+        memcpy(cap->pend[idx], cap->buf + end, len - end);
+        if (end > 0 && !skip_output(cap, cap->buf, end))
+            post_output(cap, CATEGORIES[idx], cap->buf, end);
+    }
+}
+
+static void *capture_thread(void *ud) {
+    capture_t *cap = ud;
+    struct pollfd pfds[CAPTURE_NFD + 1];
+    for (;;) {
+        int i;
+        for (i = 0; i < CAPTURE_NFD; ++i) {
+            pfds[i].fd = cap->rfds[i];
+            pfds[i].events = POLLIN;
+            pfds[i].revents = 0;
+        }
+        pfds[CAPTURE_NFD].fd = cap->wakefds[0];
+        pfds[CAPTURE_NFD].events = POLLIN;
+        pfds[CAPTURE_NFD].revents = 0;
+        if (poll(pfds, CAPTURE_NFD + 1, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (pfds[CAPTURE_NFD].revents)
+            break;
+        pthread_mutex_lock(&cap->mutex);
+        for (i = 0; i < CAPTURE_NFD; ++i) {
+            if (pfds[i].revents) read_pipe(cap, i);
+        }
+        pthread_mutex_unlock(&cap->mutex);
+    }
+    return NULL;
+}
+
+static void set_flags(int fd, bool nonblock) {
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    if (nonblock) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+bool capture_start(capture_t *cap, vscio_t *io) {
+    int pipes[CAPTURE_NFD][2];
+    int i;
+    for (i = 0; i < CAPTURE_NFD; ++i) {
+        if (pipe(pipes[i]) < 0) {
+            while (--i >= 0) {
+                close(pipes[i][0]);
+                close(pipes[i][1]);
+            }
+            return false;
+        }
+    }
+    if (pipe(cap->wakefds) < 0) {
+        for (i = 0; i < CAPTURE_NFD; ++i) {
+            close(pipes[i][0]);
+            close(pipes[i][1]);
+        }
+        return false;
+    }
+    set_flags(cap->wakefds[0], false);
+    set_flags(cap->wakefds[1], false);
+
+    fflush(stdout);
+    fflush(stderr);
+    for (i = 0; i < CAPTURE_NFD; ++i) {
+        int fd = i + 1;
+        cap->savedfds[i] = fcntl(fd, F_DUPFD_CLOEXEC, 3);
+        dup2(pipes[i][1], fd);
+        close(pipes[i][1]);
+        cap->rfds[i] = pipes[i][0];
+        set_flags(cap->rfds[i], true);
+    }
+    // stdout现在是管道，默认全缓冲，改成行缓冲，io.write的输出按行及时发出
+    setvbuf(stdout, NULL, _IOLBF, BUFSIZ);
+
+    cap->io = io;
+    cap->buf = malloc(CAPTURE_BUFSIZE + 4);
+    pthread_mutex_init(&cap->mutex, NULL);
+    if (pthread_create(&cap->thread, NULL, capture_thread, cap) != 0) {
+        // 没有读线程，管道满了被调试的代码会阻塞，恢复原样
+        pthread_mutex_destroy(&cap->mutex);
+        cap->io = NULL;
+        cap->started = true;
+        capture_free(cap);
+        return false;
+    }
+    cap->started = true;
+    return true;
+}
+
+void capture_drain(capture_t *cap) {
+    if (!cap->started) return;
+    fflush(stdout);
+    pthread_mutex_lock(&cap->mutex);
+    int i;
+    for (i = 0; i < CAPTURE_NFD; ++i)
+        read_pipe(cap, i);
+    if ((cap->dropped || cap->spilled) && !vscio_wfull(cap->io)) report_skipped(cap);
+    pthread_mutex_unlock(&cap->mutex);
+}
+
+void capture_free(capture_t *cap) {
+    if (!cap->started) return;
+    fflush(stdout);
+    fflush(stderr);
+    // 恢复fd 1和2，写端只剩下子进程可能还拿着，读完已有的内容就可以退出了
+    int i;
+    for (i = 0; i < CAPTURE_NFD; ++i) {
+        if (cap->savedfds[i] >= 0) {
+            dup2(cap->savedfds[i], i + 1);
+            close(cap->savedfds[i]);
+        }
+    }
+    if (cap->io) {
+        capture_drain(cap);
+        if (write(cap->wakefds[1], "", 1) == 1)
+            pthread_join(cap->thread, NULL);
+        pthread_mutex_destroy(&cap->mutex);
+    }
+    for (i = 0; i < CAPTURE_NFD; ++i) {
+        if (cap->rfds[i] >= 0) close(cap->rfds[i]);
+    }
+    close(cap->wakefds[0]);
+    close(cap->wakefds[1]);
+    free(cap->buf);
+    outbuf_free(&cap->json);
+    if (cap->spillfd >= 0) close(cap->spillfd);
+    free(cap->spillpath);
+    capture_init(cap);
+}
@@ -0,0 +1,48 @@
+/**
+ * 捕获被调试进程的标准输出和标准错误：fd 1和2重定向到管道，读线程把读到的内容编码成output事件，
+ * 直接放进IO的写队列。io.write、io.stderr:write、C模块里的printf都不经过lua_writestring，只能这样拿到；
+ * 与VSCode通讯改用原来stdout的一个副本
+ * by code
+ */
+#ifndef __CAPTURE_H__
+#define __CAPTURE_H__
+#include "defines.h"
+#include "vscio.h"
+#include "outbuf.h"
+
+// 捕获的fd：0是stdout，1是stderr
+#define CAPTURE_NFD 2
+// 一次读的大小
+#define CAPTURE_BUFSIZE (64 * 1024)
+
+typedef struct capture {
+    vscio_t *io;                // 发送output事件的IO
+    int rfds[CAPTURE_NFD];      // 管道的读端，-1表示已经关闭
+    int savedfds[CAPTURE_NFD];  // 重定向前的fd 1和2，停止时恢复
+    int wakefds[2];             // 通知读线程退出的管道
+    pthread_t thread;
+    bool started;
+    pthread_mutex_t mutex;      // 读线程和主线程都可能读管道，同时只能有一个
+    char pend[CAPTURE_NFD][4];  // 上次读到的末尾不完整的UTF-8字符，留到下次一起发
+    int npend[CAPTURE_NFD];
+    char *buf;                  // 读缓冲
+    outbuf_t json;              // 事件的编码缓冲
+    bool skip;                  // 写队列满了时不等待，丢掉或转存，以下各项也由mutex保护
+    char *spillpath;            // 转存的文件，NULL表示丢掉
+    int spillfd;
+    size_t dropped;             // 丢掉了还没报告的字节数
+    size_t spilled;             // 转存了还没报告的字节数
+} capture_t;
+
+void capture_init(capture_t *cap);
+// 设置写队列满了时的处理方式，和print的输出策略一致：skip为false时等待，
+// 否则有spillpath时追加到这个文件，没有时丢掉，写队列有空间后补一行说明
+void capture_set_policy(capture_t *cap, bool skip, const char *spillpath);
+// 把fd 1和2重定向到管道并启动读线程，失败时返回false，fd保持原样
+bool capture_start(capture_t *cap, vscio_t *io);
+// 把管道里已经有的内容都发出去，暂停和脚本结束前调用，保证输出在后面的事件之前
+void capture_drain(capture_t *cap);
+// 恢复fd 1和2，发出剩下的内容后停止读线程
+void capture_free(capture_t *cap);
+
+#endif // __CAPTURE_H__
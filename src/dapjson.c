@@ -0,0 +1,68 @@
+/**
+ * DAP消息的JSON编码
+ * by code
+ */
+#include "dapjson.h"
+
+void dapjson_escape(outbuf_t *ob, const char *s, size_t len) {
+    static const char hex[] = "0123456789abcdef";
+    char *p = outbuf_reserve(ob, len * 6);
+    const char *e = s + len;
+    for (; s < e; ++s) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            *p++ = '\\';
+            *p++ = c;
+        } else if (c == '\n') {
+            *p++ = '\\';
+            *p++ = 'n';
+        } else if (c == '\r') {
+            *p++ = '\\';
+            *p++ = 'r';
+        } else if (c == '\t') {
+            *p++ = '\\';
+            *p++ = 't';
+        } else if (c < 0x20 || c == 0x7f) {
+            memcpy(p, "\\u00", 4);
+            p[4] = hex[c >> 4];
+            p[5] = hex[c & 0xf];
+            p += 6;
+        } else {
+            *p++ = c;
+        }
+    }
+    ob->len = p - ob->buf;
+}
+
+void dapjson_string(outbuf_t *ob, const char *s, size_t len) {
+    dapjson_lit(ob, "\"");
+    dapjson_escape(ob, s, len);
+    dapjson_lit(ob, "\"");
+}
+
+void dapjson_integer(outbuf_t *ob, long long v) {
+    char *p = outbuf_reserve(ob, 24);
+    ob->len += sprintf(p, "%lld", v);
+}
+
+void dapjson_response(outbuf_t *ob, long long seq, long long rseq, const char *command) {
+    dapjson_lit(ob, "{\"seq\":");
+    dapjson_integer(ob, seq);
+    dapjson_lit(ob, ",\"type\":\"response\",\"request_seq\":");
+    dapjson_integer(ob, rseq);
+    dapjson_lit(ob, ",\"command\":");
+    dapjson_string(ob, command, strlen(command));
+    dapjson_lit(ob, ",\"success\":true,\"body\":");
+}
+
+void dapjson_event(outbuf_t *ob, long long seq, const char *event) {
+    dapjson_lit(ob, "{\"seq\":");
+    dapjson_integer(ob, seq);
+    dapjson_lit(ob, ",\"type\":\"event\",\"event\":");
+    dapjson_string(ob, event, strlen(event));
+    dapjson_lit(ob, ",\"body\":");
+}
+
+void dapjson_end(outbuf_t *ob) {
+    dapjson_lit(ob, "}");
+}
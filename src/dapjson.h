@@ -0,0 +1,25 @@
+/**
+ * DAP消息的JSON编码：stackTrace、variables这类大的回应在C里直接编码进缓冲，
+ * 不在调试器虚拟机里先构造表再交给cjson
+ * by code
+ */
+#ifndef __DAPJSON_H__
+#define __DAPJSON_H__
+#include "defines.h"
+#include "outbuf.h"
+
+// 追加JSON文本，s必须是字符串字面量
+#define dapjson_lit(ob, s) outbuf_append((ob), (s), sizeof(s) - 1)
+
+// 追加转义后的字符串内容，不加引号；字节原样保留，只转义引号、反斜杠和控制字符
+void dapjson_escape(outbuf_t *ob, const char *s, size_t len);
+// 追加带引号的字符串
+void dapjson_string(outbuf_t *ob, const char *s, size_t len);
+void dapjson_integer(outbuf_t *ob, long long v);
+// 成功回应的开头，后面接着写body的值，最后用dapjson_end结束
+void dapjson_response(outbuf_t *ob, long long seq, long long rseq, const char *command);
+// 事件的开头，后面接着写body的值，最后用dapjson_end结束
+void dapjson_event(outbuf_t *ob, long long seq, const char *event);
+void dapjson_end(outbuf_t *ob);
+
+#endif // __DAPJSON_H__
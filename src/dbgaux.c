@@ -4,8 +4,10 @@
  */
 #include "dbgaux.h"
 #include "vscdbg.h"
+#include "dapjson.h"
 #include "lstate.h"
 #include "lobject.h"
+#include "ltable.h"
 
 // 增加path, cpath
 // (path, cpath) => void
@@ -63,8 +65,11 @@ static int runscript(lua_State *dL) {
         lua_pop(dL, 1);
     }
 
-    // 调用  <f|a1|a2..>
+    // 调用  <f|a1|a2..>，脚本运行前先把回应发出去
+    if (dbg->io) vscio_flush(dbg->io);
     err = lua_pcall(L, narg, LUA_MULTRET, 0);
+    // 脚本结束前缓冲的日志断点输出要先发出去
+    vscdbg_flush_output(dbg);
     if (err) {
         lua_pushboolean(dL, 0);
         lua_pushstring(dL, luaL_tolstring(L, -1, NULL));
@@ -75,207 +80,422 @@ static int runscript(lua_State *dL) {
     return 1;
 }
 
-// 取栈帧信息
-// (lua_State) => frames
-static int getstackframes(lua_State *dL) {
+// 取协程co从start层开始最多levels层栈帧，levels为0时取到栈底，直接编码成stackTrace的回应发出去，不构造Lua的表；
+// totalFrames是栈的实际层数，客户端据此决定要不要接着取后面的栈帧；
+// 栈帧ID从firstid开始连续分配，seq和请求的seq由调试器脚本给出，返回栈帧的数量
+// (co, start, levels, firstid, seq, rseq) => count
+static int sendstacktrace(lua_State *dL) {
+    vscdbg_t *dbg = vscdbg_get_from_state(dL);
     luaL_checktype(dL, 1, LUA_TLIGHTUSERDATA);
     lua_State *L = lua_touserdata(dL, 1);
-    int maxlv = luaL_checkinteger(dL, 2);
-
-    lua_newtable(dL);    // [t]
-    int level = 0;
+    int start = luaL_checkinteger(dL, 2);
+    int levels = luaL_checkinteger(dL, 3);
+    lua_Integer firstid = luaL_checkinteger(dL, 4);
+    lua_Integer seq = luaL_checkinteger(dL, 5);
+    lua_Integer rseq = luaL_checkinteger(dL, 6);
+
+    outbuf_t *ob = &dbg->jsonbuf;
+    outbuf_clear(ob, 0);
+    dapjson_response(ob, seq, rseq, "stackTrace");
+    dapjson_lit(ob, "{\"stackFrames\":[");
+    // 和lua_getstack一样按CallInfo链从栈顶往下数层级，但不用每一层都从栈顶重新数
+    int level = 0, n = 0;
     lua_Debug ar;
-    while (level < maxlv && lua_getstack(L, level, &ar)) {
+    CallInfo *ci;
+    for (ci = L->ci; ci != &L->base_ci; ci = ci->previous, level++) {
+        if (level < start || (levels > 0 && n >= levels)) continue;
+        ar.i_ci = ci;
         lua_getinfo(L, "Slnt", &ar);
-        lua_newtable(dL);  // [t|t2]
+        if (n > 0) dapjson_lit(ob, ",");
         // id
-        lua_pushinteger(dL, level); // [t|t2|level]
-        lua_setfield(dL, -2, "id");  // [t|t2]
+        dapjson_lit(ob, "{\"id\":");
+        dapjson_integer(ob, firstid + n);
         // name
         bool ismain = strcmp(ar.what, "main") == 0;
         bool islua = strcmp(ar.what, "Lua") == 0;
+        dapjson_lit(ob, ",\"name\":");
         if (ar.name)
-            lua_pushstring(dL, ar.name);
+            dapjson_string(ob, ar.name, strlen(ar.name));
         else if (ismain)
-            lua_pushstring(dL, "main chunk");
+            dapjson_lit(ob, "\"main chunk\"");
         else
-            lua_pushstring(dL, "?");
-        lua_setfield(dL, -2, "name");  // [t|t2]
+            dapjson_lit(ob, "\"?\"");
         // source
-        if ((islua || ismain) && ar.source[0] == '@') {
-            lua_newtable(dL);  // [t|t2|t3]
-            lua_pushstring(dL, ar.source+1);  // [t|t2|t3|path]
-            lua_setfield(dL, -2, "path");     // [t|t2|t3]
-            lua_setfield(dL, -2, "source");   // [t|t2]
-            lua_pushinteger(dL, 1);           // [t|t2|1]
-            lua_setfield(dL, -2, "column");   // [t|t2]
-
+        const char *path = NULL;
+        size_t len;
+        if (islua || ismain) {
+            Proto *p = clLvalue(ar.i_ci->func)->p;
+            path = srctable_getpath(&dbg->srctable, srctable_getid(&dbg->srctable, p->source), &len);
+        }
+        if (path) {
+            dapjson_lit(ob, ",\"source\":{\"path\":");
+            dapjson_string(ob, path, len);
+            dapjson_lit(ob, "},\"column\":1");
         } else {
-            lua_newtable(dL);  // [t|t2|t3]
-            lua_pushstring(dL, "deemphasize");          // [t|t2|t3|path]
-            lua_setfield(dL, -2, "presentationHint");   // [t|t2|t3]
-            lua_setfield(dL, -2, "source");             // [t|t2]
+            dapjson_lit(ob, ",\"source\":{\"presentationHint\":\"deemphasize\"}");
         }
         // line
         if (ar.currentline > 0) {
-            lua_pushinteger(dL, ar.currentline);
-            lua_setfield(dL, -2, "line");  // [t|t2]
+            dapjson_lit(ob, ",\"line\":");
+            dapjson_integer(ob, ar.currentline);
         }
-        
-        level++;
-        lua_seti(dL, -2, level);        // [t]
+        dapjson_lit(ob, "}");
+        n++;
     }
+    dapjson_lit(ob, "],\"totalFrames\":");
+    dapjson_integer(ob, level);
+    dapjson_lit(ob, "}");
+    dapjson_end(ob);
+    if (dbg->io) vscio_send(dbg->io, ob->buf, ob->len);
+    lua_pushinteger(dL, n);
     return 1;
 }
 
-static void decode_varref(lua_Integer ref, int *type, int *level, int *id) {
-    *id = ref % 10000000;
-    int v = ref / 10000000;
-    *type = v / 100;
-    *level = v % 100;
+// 线程的名字：主线程叫main，协程用入口函数的位置，入口函数已经不在栈上(结束了)时只有ID
+static void push_thread_name(lua_State *dL, vscthread_t *th) {
+    lua_State *L1 = th->L;
+    if (L1 == G(L1)->mainthread) {
+        lua_pushstring(dL, "main");
+        return;
+    }
+    // 运行过的协程入口函数在第一个CallInfo上，还没运行的在栈底等着被调用
+    const TValue *f = NULL;
+    if (L1->ci != &L1->base_ci)
+        f = L1->base_ci.next->func;
+    else if (L1->status == LUA_OK && L1->top > L1->stack + 1)
+        f = L1->stack + 1;
+    if (f && ttisLclosure(f)) {
+        // 文件只取文件名，代码字符串不显示内容
+        Proto *p = clLvalue(f)->p;
+        size_t len;
+        const char *name = srctable_getpath(&th->dbg->srctable, srctable_getid(&th->dbg->srctable, p->source), &len);
+        if (name) {
+            const char *pos = strrchr(name, '/');
+            if (pos) name = pos + 1;
+        } else if (p->source && getstr(p->source)[0] == '=') {
+            name = getstr(p->source) + 1;
+        } else {
+            name = "[string]";
+        }
+        lua_pushfstring(dL, "#%d %s:%d", th->id, name, p->linedefined);
+    } else if (f && ttisfunction(f)) {
+        lua_pushfstring(dL, "#%d [C]", th->id);
+    } else {
+        lua_pushfstring(dL, "#%d", th->id);
+    }
 }
 
-static void push_value_string(lua_State *dL, lua_State *L, int stkidx) {
-    size_t len;
-    const char *val = luaL_tolstring(L, stkidx, &len);  // <str>
-    lua_pushlstring(dL, val, len);  // [val]
-    lua_pop(L, 1);  // <>
+static void push_thread(lua_State *dL, vscthread_t *th) {
+    lua_createtable(dL, 0, 2);  // [t]
+    lua_pushinteger(dL, th->id);    // [t|id]
+    lua_setfield(dL, -2, "id");     // [t]
+    push_thread_name(dL, th);       // [t|name]
+    lua_setfield(dL, -2, "name");   // [t]
 }
 
-static void push_value_type(lua_State *dL, lua_State *L, int stkidx) {
-    const char *type = lua_typename(L, lua_type(L, stkidx));
-    lua_pushstring(dL, type);
+// 取线程列表，按创建的先后从第start个开始取最多count个；first是当前的线程，总是放在最前面。
+// 同时返回线程的总数
+// (first, start, count) => threads, total
+static int getthreads(lua_State *dL) {
+    vscdbg_t *dbg = vscdbg_get_from_state(dL);
+    lua_State *first = lua_touserdata(dL, 1);
+    int start = luaL_optinteger(dL, 2, 0);
+    int count = luaL_optinteger(dL, 3, dbg->nthreads);
+    vscthread_t *fth = first && vscdbg_get_from_state(first) == dbg ? vscdbg_get_thread(first) : NULL;
+
+    lua_createtable(dL, count < dbg->nthreads ? count + 1 : dbg->nthreads, 0);   // [t]
+    int idx = 0;
+    if (fth) {
+        push_thread(dL, fth);   // [t|th]
+        lua_seti(dL, -2, ++idx);    // [t]
+    }
+    vscthread_t *th = dbg->threads;
+    int i;
+    for (i = 0; th && i < start; ++i)
+        th = th->next;
+    for (i = 0; th && i < count; th = th->next, ++i) {
+        if (th == fth) continue;
+        push_thread(dL, th);    // [t|th]
+        lua_seti(dL, -2, ++idx);    // [t]
+    }
+    lua_pushinteger(dL, dbg->nthreads);     // [t|total]
+    return 2;
+}
+
+// 按线程ID取线程，线程已经结束返回nil
+// (id) => lua_State
+static int getthread(lua_State *dL) {
+    vscdbg_t *dbg = vscdbg_get_from_state(dL);
+    vscthread_t *th = vscdbg_find_thread(dbg, luaL_checkinteger(dL, 1));
+    if (th)
+        lua_pushlightuserdata(dL, th->L);
+    else
+        lua_pushnil(dL);
+    return 1;
 }
 
-static int cachekey = 0;
-static int idkey = 0;
-static void cache_var_value(lua_State *L, int id, int stkidx) {
-    lua_rawgetp(L, LUA_REGISTRYINDEX, &cachekey);   // <ct>
-    if (lua_isnoneornil(L, -1)) {
-        lua_newtable(L);  // <nil|ct>
-        lua_copy(L, -1, -2);    // <ct|ct>
-        lua_rawsetp(L, LUA_REGISTRYINDEX, &cachekey);  // <ct>
+// 取线程的ID
+// (lua_State) => id
+static int getthreadid(lua_State *dL) {
+    luaL_checktype(dL, 1, LUA_TLIGHTUSERDATA);
+    lua_State *L = lua_touserdata(dL, 1);
+    lua_pushinteger(dL, vscdbg_get_thread(L)->id);
+    return 1;
+}
+
+// 去掉表t里已经释放了的线程，t以线程(lua_State的lightuserdata)为键
+// (t) => count  剩下的数量
+static int prunethreads(lua_State *dL) {
+    vscdbg_t *dbg = vscdbg_get_from_state(dL);
+    luaL_checktype(dL, 1, LUA_TTABLE);
+    lua_settop(dL, 1);
+    lua_createtable(dL, 0, dbg->nthreads);  // [t|live]
+    for (vscthread_t *th = dbg->threads; th; th = th->next) {
+        lua_pushboolean(dL, 1);
+        lua_rawsetp(dL, 2, th->L);
     }
-    /*  t = {
-            id = v,
-            v = id,
+    // 遍历的时候把已有的键设为nil是允许的
+    int n = 0;
+    lua_pushnil(dL);    // [t|live|k]
+    while (lua_next(dL, 1)) {
+        lua_pop(dL, 1); // [t|live|k]
+        if (lua_type(dL, 3) == LUA_TLIGHTUSERDATA && lua_rawgetp(dL, 2, lua_touserdata(dL, 3)) == LUA_TNIL) {
+            lua_pop(dL, 1);
+            lua_pushvalue(dL, 3);
+            lua_pushnil(dL);
+            lua_rawset(dL, 1);
+        } else {
+            lua_settop(dL, 3);
+            n++;
         }
-    */
-    lua_pushvalue(L, stkidx);   // <ct|v>
-    lua_seti(L, -2, id);    // <ct>
-    lua_pushvalue(L, stkidx);   // <ct|v>
-    lua_pushinteger(L, id); // <ct|v|id>
-    lua_settable(L, -3);   // <ct>
+    }
+    lua_pushinteger(dL, n);
+    return 1;
+}
+
+// 栈上stkidx位置的值，stkidx是正的索引
+static const TValue *stack_value(lua_State *L, int stkidx) {
+    return L->ci->func + stkidx;
+}
+
+// 完整的值，会调用__tostring，只在客户端要求时使用
+static void write_value_string(outbuf_t *ob, lua_State *L, int stkidx) {
+    size_t len;
+    const char *val = luaL_tolstring(L, stkidx, &len);  // <str>
+    dapjson_string(ob, val, len);
     lua_pop(L, 1);  // <>
 }
 
-static bool get_val_from_cache(lua_State *L, int id) {
-    lua_rawgetp(L, LUA_REGISTRYINDEX, &cachekey);   // <ct>
-    if (lua_isnoneornil(L, -1)) {
-        lua_pop(L, 1);
-        return false;
-    }
-    lua_geti(L, -1, id);  // <ct|v>
-    if (lua_isnoneornil(L, -1)) {
-        lua_pop(L, 2);
-        return false;
+// 字符串预览的最大长度
+#define PREVIEW_STRLEN 256
+
+// 以下write_*写的是转义后的JSON字符串内容，不带引号
+
+// 类型名加地址，有__name的用__name
+static void write_value_pointer(outbuf_t *ob, lua_State *L, int stkidx) {
+    char buff[64];
+    size_t len;
+    const char *name = lua_typename(L, lua_type(L, stkidx));
+    int tt = luaL_getmetafield(L, stkidx, "__name");  // <name>
+    if (tt == LUA_TSTRING) {
+        name = lua_tolstring(L, -1, &len);
+        dapjson_escape(ob, name, len);
     } else {
-        lua_replace(L, -2); // <v>
-        return true;
+        dapjson_escape(ob, name, strlen(name));
     }
+    dapjson_escape(ob, buff, snprintf(buff, sizeof(buff), ": %p", lua_topointer(L, stkidx)));
+    if (tt != LUA_TNIL) lua_pop(L, 1);   // <>
 }
 
-static int get_id_from_cache(lua_State *L, int stkidx) {
-    lua_rawgetp(L, LUA_REGISTRYINDEX, &cachekey);   // <ct>
-    if (lua_isnoneornil(L, -1)) {
-        lua_pop(L, 1);  // <>
-        return 0;
+// 变量值的预览：直接按类型格式化，不调用__tostring，也不在被调试的虚拟机里创建字符串
+static void write_value_preview(outbuf_t *ob, lua_State *L, int stkidx) {
+    char buff[64];
+    switch (lua_type(L, stkidx)) {
+    case LUA_TNIL:
+        dapjson_lit(ob, "nil");
+        break;
+    case LUA_TBOOLEAN:
+        if (lua_toboolean(L, stkidx))
+            dapjson_lit(ob, "true");
+        else
+            dapjson_lit(ob, "false");
+        break;
+    case LUA_TNUMBER:
+        if (lua_isinteger(L, stkidx)) {
+            dapjson_integer(ob, (long long)lua_tointeger(L, stkidx));
+        } else {
+            // 和tostring一样，整数值的浮点数后面加.0
+            int len = lua_number2str(buff, sizeof(buff) - 2, lua_tonumber(L, stkidx));
+            if (buff[strspn(buff, "-0123456789")] == '\0') {
+                buff[len++] = '.';
+                buff[len++] = '0';
+            }
+            outbuf_append(ob, buff, len);
+        }
+        break;
+    case LUA_TSTRING: {
+        size_t len;
+        const char *str = lua_tolstring(L, stkidx, &len);
+        if (len > PREVIEW_STRLEN) {
+            // 截断处往前退到UTF-8字符的开头，不把一个多字节字符切成两半
+            size_t cut = PREVIEW_STRLEN;
+            while (cut > PREVIEW_STRLEN - 4 && ((unsigned char)str[cut] & 0xC0) == 0x80)
+                cut--;
+            dapjson_escape(ob, str, cut);
+            dapjson_lit(ob, "...");
+        } else {
+            dapjson_escape(ob, str, len);
+        }
+        break;
     }
-    lua_pushvalue(L, stkidx);   // <ct|v>
-    lua_gettable(L, -2);    // <ct|id>
-    int id = 0;
-    if (!lua_isnoneornil(L, -1)) {
-        id = lua_tointeger(L, -1);
+    case LUA_TTABLE: {
+        // 显示数组部分的长度，只有哈希部分的显示table{...}
+        const Table *t = hvalue(stack_value(L, stkidx));
+        int len = (int)lua_rawlen(L, stkidx);
+        if (len == 0 && !isdummy(t))
+            dapjson_lit(ob, "table{...}");
+        else
+            outbuf_append(ob, buff, snprintf(buff, sizeof(buff), "table[%d]", len));
+        break;
+    }
+    default:
+        write_value_pointer(ob, L, stkidx);
+        break;
+    }
+}
+
+// 表成员的名字：字符串和数字键就是它本身，其他的键用类型加地址区分
+static void write_key_name(outbuf_t *ob, lua_State *L, int stkidx) {
+    int type = lua_type(L, stkidx);
+    if (type == LUA_TSTRING) {
+        size_t len;
+        const char *str = lua_tolstring(L, stkidx, &len);
+        dapjson_escape(ob, str, len);
+    } else if (type == LUA_TNUMBER || type == LUA_TBOOLEAN) {
+        write_value_preview(ob, L, stkidx);
+    } else {
+        write_value_pointer(ob, L, stkidx);
     }
-    lua_pop(L, 2);  // <>
-    return id;
 }
 
-static void clear_var_cache(lua_State *L) {
-    lua_pushnil(L);
-    lua_rawsetp(L, LUA_REGISTRYINDEX, &cachekey);
-    lua_pushinteger(L, 0);
-    lua_rawsetp(L, LUA_REGISTRYINDEX, &idkey);
+static void write_value_type(outbuf_t *ob, lua_State *L, int stkidx) {
+    const char *type = lua_typename(L, lua_type(L, stkidx));
+    dapjson_string(ob, type, strlen(type));
 }
 
-static int gen_next_id(lua_State *L) {
-    lua_rawgetp(L, LUA_REGISTRYINDEX, &idkey); // <id>
-    int id = 0;
-    if (!lua_isnoneornil(L, -1))
-        id = lua_tointeger(L, -1);
-    lua_pop(L, 1);  // <>
-    id++;
-    lua_pushinteger(L, id);     // <id>
-    lua_rawsetp(L, LUA_REGISTRYINDEX, &idkey);  // <>
-    return id;
-}
-
-static int push_varref(lua_State *dL, lua_State *L, int stkidx) {
-    if (lua_type(L, stkidx) == LUA_TTABLE) {
-        // 先看能不能从缓存中取出ID
-        int id = get_id_from_cache(L, stkidx);
-        if (!id) {
-            // 不行再生成新的ID
-            id = gen_next_id(L);
-            lua_pushinteger(dL, id);  // [id]
-        } else {
-            lua_pushinteger(dL, id);
-        }
-        return id;
-    } else {
-        lua_pushinteger(dL, 0);  // [id]
+// 有__tostring的userdata，值先只给预览，客户端要看时再通过变量引用取完整的值
+static int is_lazy_value(lua_State *L, int stkidx) {
+    if (lua_type(L, stkidx) != LUA_TUSERDATA)
         return 0;
-    }
+    if (luaL_getmetafield(L, stkidx, "__tostring") == LUA_TNIL)
+        return 0;
+    lua_pop(L, 1);
+    return 1;
 }
 
-static int clearvarcache(lua_State *dL) {
-    luaL_checktype(dL, 1, LUA_TLIGHTUSERDATA);
-    lua_State *L = lua_touserdata(dL, 1);
-    clear_var_cache(L);
+// 表和lazy值的句柄，变量引用是句柄乘4，低两位为0，和debugger.lua里栈帧作用域的编码区分开；
+// 只有暂停时才分配句柄，继续运行时句柄就换代了
+static lua_Integer get_varref(lua_State *L, int stkidx) {
+    vscdbg_t *dbg = vscdbg_get_from_state(L);
+    if ((lua_type(L, stkidx) == LUA_TTABLE || is_lazy_value(L, stkidx)) && dbg->state == ST_PAUSE)
+        return varcache_add(&dbg->varcache, L, stkidx);
     return 0;
 }
 
-static void add_var_info(lua_State *dL, lua_State *L, const char *name, int idx, int stkidx) {
-    lua_newtable(dL);    // [t|t1]
-    lua_pushstring(dL, name); // [t|t1|name]
-    lua_setfield(dL, -2, "name"); // [t|t1]
-    
-    push_value_string(dL, L, stkidx);       // [t|t1|value]
-    lua_setfield(dL, -2, "value"); // [t|t1]
+// 超过这个数量的表按分页返回成员
+#define VARS_PAGE 100
+
+// 表的槽位数：数组部分和哈希部分的大小之和，空槽也算
+static int table_slots(const Table *t) {
+    return (int)t->sizearray + allocsizenode(t);
+}
 
-    push_value_type(dL, L, stkidx); // [t|t1|type]
-    lua_setfield(dL, -2, "type"); // [t|t1]
+// 槽位上的值，空槽返回NULL；槽位先是数组部分再是哈希部分
+static const TValue *slot_value(const Table *t, int slot) {
+    const TValue *val = slot < (int)t->sizearray ? &t->array[slot] : gval(gnode(t, slot - t->sizearray));
+    return ttisnil(val) ? NULL : val;
+}
 
-    int id = push_varref(dL, L, stkidx);    // [t|t1|varref]
-    lua_setfield(dL, -2, "variablesReference");   // [t|t1]
+// 把槽位上的键和值压到L上，槽位不能是空的
+static void push_slot(lua_State *L, const Table *t, int slot) {
+    if (slot < (int)t->sizearray) {
+        lua_pushinteger(L, slot + 1);   // <k>
+    } else {
+        *L->top = *gkey(gnode(t, slot - t->sizearray));
+        L->top++;   // <k>
+    }
+    *L->top = *slot_value(t, slot);
+    L->top++;   // <k|v>
+}
 
-    lua_seti(dL, -2, idx);        // [t]
+// 数组部分从1开始连续非nil的长度，这一段是indexed成员，第i个就在数组的i-1位置上
+static int table_border(const Table *t) {
+    int n = 0;
+    while (n < (int)t->sizearray && !ttisnil(&t->array[n]))
+        n++;
+    return n;
+}
 
-    // 缓存对象
-    if (id) cache_var_value(L, id, stkidx);
+// named成员数：数组部分连续段之后的和哈希部分的非nil成员，要把槽位看一遍，只在大表上算
+static int table_named_count(const Table *t, int border) {
+    int n = 0;
+    for (int i = border; i < table_slots(t); i++) {
+        if (slot_value(t, i)) n++;
+    }
+    return n;
 }
 
-static void get_func_params(lua_State *dL, lua_State *L, lua_Debug *ar) {
+// 写一个变量，count是已经写了的变量数；name为NULL时名字用栈上stkidx-1位置的键
+static void add_var_info(outbuf_t *ob, lua_State *L, const char *name, int stkidx, int *count) {
+    if ((*count)++) dapjson_lit(ob, ",");
+    dapjson_lit(ob, "{\"name\":\"");
+    if (name)
+        dapjson_escape(ob, name, strlen(name));
+    else
+        write_key_name(ob, L, stkidx - 1);
+    dapjson_lit(ob, "\",\"value\":\"");
+    write_value_preview(ob, L, stkidx);
+    dapjson_lit(ob, "\",\"type\":");
+    write_value_type(ob, L, stkidx);
+
+    lua_Integer handle = get_varref(L, stkidx);
+    dapjson_lit(ob, ",\"variablesReference\":");
+    dapjson_integer(ob, handle * 4);
+    if (handle) {
+        if (!lua_istable(L, stkidx)) {
+            dapjson_lit(ob, ",\"presentationHint\":{\"lazy\":true}");
+        } else {
+            // 槽位多的表让客户端分页来取：数组部分开头的连续段是indexed，其余的是named
+            const Table *t = hvalue(stack_value(L, stkidx));
+            if (table_slots(t) > VARS_PAGE) {
+                int border = table_border(t);
+                dapjson_lit(ob, ",\"indexedVariables\":");
+                dapjson_integer(ob, border);
+                dapjson_lit(ob, ",\"namedVariables\":");
+                dapjson_integer(ob, table_named_count(t, border));
+            }
+        }
+    }
+    dapjson_lit(ob, "}");
+}
+
+// 取线程co栈帧ar上的局部变量，放到L的栈顶；co是挂起的协程时，变量的值在L上处理，不在co上调用函数
+static const char *get_local(lua_State *L, lua_State *co, lua_Debug *ar, int n) {
+    const char *name = lua_getlocal(co, ar, n);
+    if (name) lua_xmove(co, L, 1);
+    return name;
+}
+
+static void get_func_params(outbuf_t *ob, lua_State *L, lua_State *co, lua_Debug *ar, int *count) {
     int i;
-    lua_newtable(dL);    // [t]
     if (isLua(ar->i_ci)) {
         Proto *p = clLvalue(ar->i_ci->func)->p;
         // 固定参数
-        int idx = 1;
         for (i = 1; i <= p->numparams; i++) {
-            const char *name = lua_getlocal(L, ar, i);
+            const char *name = get_local(L, co, ar, i);
             if (name) {     // <a>
-                add_var_info(dL, L, name, idx++, lua_gettop(L));   // [t]
+                add_var_info(ob, L, name, lua_gettop(L), count);
+                lua_pop(L, 1);  // <>
             } else {
                 break;
             }
@@ -283,50 +503,44 @@ static void get_func_params(lua_State *dL, lua_State *L, lua_Debug *ar) {
         // 可变参数
         char varname[20] = {0};
         for (i = -1; ;--i) {
-            const char *name = lua_getlocal(L, ar, i);
+            const char *name = get_local(L, co, ar, i);
             if (name) {     // <a>
                 sprintf(varname, "vararg%d", -i);
-                add_var_info(dL, L, varname, idx++, lua_gettop(L));   // [t]
+                add_var_info(ob, L, varname, lua_gettop(L), count);
+                lua_pop(L, 1);  // <>
             } else {
                 break;
             }
         }
     }
-    lua_pushboolean(dL, 1);     // [t|true]
-    lua_insert(dL, -2);         // [true|t]
 }
 
-static void get_func_locals(lua_State *dL, lua_State *L, lua_Debug *ar) {
-    lua_newtable(dL);    // [t]
+static void get_func_locals(outbuf_t *ob, lua_State *L, lua_State *co, lua_Debug *ar, int *count) {
     if (isLua(ar->i_ci)) {
         Proto *p = clLvalue(ar->i_ci->func)->p;
         int i;
-        int idx = 1;
         for (i = p->numparams+1; ; i++) {
-            const char *name = lua_getlocal(L, ar, i);
+            const char *name = get_local(L, co, ar, i);
             if (name) {     // <a>
                 if (strcmp(name , "(*temporary)"))
-                    add_var_info(dL, L, name, idx++, lua_gettop(L));   // [t]
+                    add_var_info(ob, L, name, lua_gettop(L), count);
                 lua_pop(L, 1);  // <>
             } else {
                 break;
             }
         }
     }
-    lua_pushboolean(dL, 1);     // [t|true]
-    lua_insert(dL, -2);         // [true|t]
 }
 
-static void get_func_upvalue(lua_State *dL, lua_State *L, lua_Debug *ar) {
-    lua_newtable(dL);    // [t]
+static void get_func_upvalue(outbuf_t *ob, lua_State *L, lua_State *co, lua_Debug *ar, int *count) {
     if (isLua(ar->i_ci)) {
-        lua_getinfo(L, "f", ar);   // <f>
-        int idx = 1;
+        lua_getinfo(co, "f", ar);
+        lua_xmove(co, L, 1);    // <f>
         int i;
         for (i = 1; ; ++i) {
             const char *name = lua_getupvalue(L, -1, i);
             if (name) { // <f|uv>
-                add_var_info(dL, L, name, idx++, lua_gettop(L));
+                add_var_info(ob, L, name, lua_gettop(L), count);
                 lua_pop(L, 1);  // <f>
             } else {
                 break;
@@ -334,100 +548,192 @@ static void get_func_upvalue(lua_State *dL, lua_State *L, lua_Debug *ar) {
         }
         lua_pop(L, 1);  // <>
     }
-    lua_pushboolean(dL, 1);     // [t|true]
-    lua_insert(dL, -2);         // [true|t]
 }
 
-static void get_table_fields(lua_State *dL, lua_State *L, int id) {
-    if (!get_val_from_cache(L, id)) {
-        lua_pushboolean(dL, 0);
-        lua_pushstring(dL, "variable invalid");
-        return;
-    } // <t>
+// 取表成员时的过滤方式
+#define FILTER_ALL 0        // 所有成员
+#define FILTER_INDEXED 1    // 数组部分开头的连续段，按下标分页
+#define FILTER_NAMED 2      // 其余的成员，按非nil成员的序号分页
 
-    lua_pushnil(dL);     // [nil]
-    lua_newtable(dL);    // [nil|t]
-
-    int idx = 1;
-    lua_pushnil(L); // <t|nil>
-    while (idx < 100 && lua_next(L, -2)) {  // <t|k|v>
-        push_value_string(dL, L, -2);  // [nil|t|key]
-        lua_replace(dL, -3);    // [key|t]
-        add_var_info(dL, L, lua_tostring(dL, -2), idx++, lua_gettop(L));  
-        lua_pop(L, 1);  // <t|k>
+// 取表的第[start, start+count)个成员，count为0时取到最后，出错时返回错误信息。
+// indexed成员直接从数组的下标开始取；named成员记住上一页停在哪个槽位，顺序翻页时接着往后找，
+// 不用从头数过来；空槽跳过，每页都取满count个非nil成员
+static const char *get_table_fields(outbuf_t *ob, lua_State *L, lua_Integer handle, int filter, int start, int count, int *n) {
+    vscdbg_t *dbg = vscdbg_get_from_state(L);
+    luaL_checkstack(L, LUA_MINSTACK, NULL);
+    if (!varcache_push(&dbg->varcache, L, handle))
+        return "variable invalid";
+    // <t>
+    if (!lua_istable(L, -1)) {
+        // lazy值，客户端要看完整的值，这时才调用__tostring
+        dapjson_lit(ob, "{\"name\":\"value\",\"value\":");
+        write_value_string(ob, L, lua_gettop(L));
+        dapjson_lit(ob, ",\"type\":");
+        write_value_type(ob, L, lua_gettop(L));
+        dapjson_lit(ob, ",\"variablesReference\":0}");
+        lua_pop(L, 1);  // <>
+        return NULL;
+    }
+    Table *t = hvalue(stack_value(L, lua_gettop(L)));
+    if (start < 0) start = 0;
+
+    // 调试代码(__tostring)可能改了表，每次重新检查大小
+    int got = 0;
+    if (filter == FILTER_INDEXED) {
+        for (int i = start; i < (int)t->sizearray && (count <= 0 || got < count); ++i, ++got) {
+            if (!slot_value(t, i)) break;
+            push_slot(L, t, i);     // <t|k|v>
+            add_var_info(ob, L, NULL, lua_gettop(L), n);
+            lua_pop(L, 2);  // <t>
+        }
+    } else {
+        int slot = 0, skip = 0;
+        if (filter == FILTER_NAMED) {
+            if (dbg->namedcursor.handle == handle && dbg->namedcursor.start == start &&
+                dbg->namedcursor.node == t->node && dbg->namedcursor.sizearray == t->sizearray) {
+                slot = dbg->namedcursor.slot;
+            } else {
+                slot = table_border(t);
+                skip = start;
+            }
+        }
+        for (; slot < table_slots(t) && (count <= 0 || got < count); ++slot) {
+            if (!slot_value(t, slot)) continue;
+            if (skip > 0) {
+                skip--;
+                continue;
+            }
+            push_slot(L, t, slot);  // <t|k|v>
+            add_var_info(ob, L, NULL, lua_gettop(L), n);
+            lua_pop(L, 2);  // <t>
+            got++;
+        }
+        if (filter == FILTER_NAMED) {
+            dbg->namedcursor.handle = handle;
+            dbg->namedcursor.start = start + got;
+            dbg->namedcursor.slot = slot;
+            dbg->namedcursor.node = t->node;
+            dbg->namedcursor.sizearray = t->sizearray;
+        }
     }
     lua_pop(L, 1);  // <>
-
-    lua_pushboolean(dL, 1);     // [key|t|true]
-    lua_replace(dL, -3);         // [true|t]
+    return NULL;
 }
 
-// 取变量信息
-// (lua_State, ref) => ok, vars
-static int getvars(lua_State *dL) {
+// 取变量并直接编码成variables的回应发出去，不构造Lua的表；seq和请求的seq由调试器脚本给出。
+// type是栈帧的作用域(1参数，2局部变量，3上值)，handle不为0时取表的成员，filter为indexed或named时按start/count分页
+// (L, co, type, level, handle, filter, start, count, seq, rseq) => ok, err
+static int sendvars(lua_State *dL) {
+    vscdbg_t *dbg = vscdbg_get_from_state(dL);
     luaL_checktype(dL, 1, LUA_TLIGHTUSERDATA);
     lua_State *L = lua_touserdata(dL, 1);
-    lua_Integer ref = luaL_checkinteger(dL, 2);
-    int type, level, id;
-    decode_varref(ref, &type, &level, &id); 
-    if (id == 0) {
+    luaL_checktype(dL, 2, LUA_TLIGHTUSERDATA);
+    lua_State *co = lua_touserdata(dL, 2);
+    int type = luaL_checkinteger(dL, 3);
+    int level = luaL_checkinteger(dL, 4);
+    lua_Integer handle = luaL_checkinteger(dL, 5);
+    const char *filter = luaL_optstring(dL, 6, "");
+    int start = luaL_optinteger(dL, 7, 0);
+    int count = luaL_optinteger(dL, 8, 0);
+    lua_Integer seq = luaL_checkinteger(dL, 9);
+    lua_Integer rseq = luaL_checkinteger(dL, 10);
+
+    outbuf_t *ob = &dbg->jsonbuf;
+    outbuf_clear(ob, 0);
+    dapjson_response(ob, seq, rseq, "variables");
+    dapjson_lit(ob, "{\"variables\":[");
+    const char *err = NULL;
+    int n = 0;
+    if (handle == 0) {
         // 取level层栈帧的变量
         lua_Debug ar;
-        if (lua_getstack(L, level, &ar)) {
+        if (lua_getstack(co, level, &ar)) {
             if (type == 1) {    // 参数
-                get_func_params(dL, L, &ar);
+                get_func_params(ob, L, co, &ar, &n);
             } else if (type == 2) {
-                get_func_locals(dL, L, &ar);
+                get_func_locals(ob, L, co, &ar, &n);
             } else if (type == 3) {
-                get_func_upvalue(dL, L, &ar);
+                get_func_upvalue(ob, L, co, &ar, &n);
             } else {
-                lua_pushboolean(dL, 0);
-                lua_pushstring(dL, "scope invalid");
+                err = "scope invalid";
             }
         } else {
-            lua_pushboolean(dL, 0);
-            lua_pushstring(dL, "frameId invalid");
+            err = "frameId invalid";
         } 
     } else {
-        // 取变量的内部成员
-        get_table_fields(dL, L, id);
+        // 取变量的内部成员；大表给出了indexedVariables和namedVariables，客户端按filter分别分页来取
+        int f = FILTER_ALL;
+        if (strcmp(filter, "indexed") == 0)
+            f = FILTER_INDEXED;
+        else if (strcmp(filter, "named") == 0)
+            f = FILTER_NAMED;
+        else
+            start = count = 0;
+        err = get_table_fields(ob, L, handle, f, start, count, &n);
     }
-    return 2;
+    if (err) {
+        lua_pushboolean(dL, 0);
+        lua_pushstring(dL, err);
+        return 2;
+    }
+    dapjson_lit(ob, "]}");
+    dapjson_end(ob);
+    if (dbg->io) vscio_send(dbg->io, ob->buf, ob->len);
+    lua_pushboolean(dL, 1);
+    return 1;
+}
+
+// 把线程co作为值压到L上
+static void push_thread_value(lua_State *L, lua_State *co) {
+    lua_pushthread(co);
+    lua_xmove(co, L, 1);
 }
 
-// 表达式求值
-// (co, expr, level) => result
 static int evalkey = 0;
 static const char *LUA_EVAL = "/../injectcode.lua";
+
+// 取注入到被调试虚拟机的辅助函数表，第一次使用时加载，失败时错误对象在栈顶
+static bool load_injectcode(vscdbg_t *dbg, lua_State *L) {
+    lua_rawgetp(L, LUA_REGISTRYINDEX, &evalkey);  // <inject>
+    if (lua_istable(L, -1))
+        return true;
+    lua_pop(L, 1);  // <>
+    char path[512];
+    strcpy(path, dbg->curpath);
+    strcat(path, LUA_EVAL);
+    int error = luaL_dofile(L, path);
+    if (error)      // <err>
+        return false;
+    lua_pushvalue(L, -1); // <inject|inject>
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &evalkey);    // <inject>
+    return true;
+}
+
+// 在协程co的第level层栈帧上求值表达式，求值在当前停下来的线程L上进行
+// (lua_State, co, expr, level) => result
 static int evaluate(lua_State *dL) {
     luaL_checktype(dL, 1, LUA_TLIGHTUSERDATA);
     lua_State *L = lua_touserdata(dL, 1);
-    luaL_checktype(dL, 2, LUA_TSTRING);
-    int level = luaL_checkinteger(dL, 3);
+    luaL_checktype(dL, 2, LUA_TLIGHTUSERDATA);
+    lua_State *co = lua_touserdata(dL, 2);
+    luaL_checktype(dL, 3, LUA_TSTRING);
+    int level = luaL_checkinteger(dL, 4);
     vscdbg_t *dbg = vscdbg_get_from_state(L);
+    const char *expr = lua_tostring(dL, 3);
 
-    lua_rawgetp(L, LUA_REGISTRYINDEX, &evalkey);  // <eval>
-    if (!lua_isfunction(L, -1)) {
-        lua_pop(L, 1);  // <>
-        char path[512];
-        strcpy(path, dbg->curpath);
-        strcat(path, LUA_EVAL);
-        int error = luaL_dofile(L, path);
-        if (error) {    // <err>
-            lua_pushboolean(dL, 0); // [false]
-            lua_pushstring(dL, luaL_tolstring(L, -1, NULL));    // [false|estr]
-            lua_pop(L, 1);  // <>
-            return 2;
-        } else {    // <eval>
-            lua_pushvalue(L, -1); // <eval|eval>
-            lua_rawsetp(L, LUA_REGISTRYINDEX, &evalkey);    // <eval>
-        }
+    if (!load_injectcode(dbg, L)) {    // <err>
+        lua_pushboolean(dL, 0); // [false]
+        lua_pushstring(dL, luaL_tolstring(L, -1, NULL));    // [false|estr]
+        lua_pop(L, 2);  // <>
+        return 2;
     }
+    lua_getfield(L, -1, "evaluate");    // <inject|eval>
+    lua_remove(L, -2);      // <eval>
     lua_pushvalue(L, -1); // <eval|eval>
 
     // first, try: "return <expr>"
-    lua_pushfstring(L, "return %s", lua_tostring(dL, 2));   // <eval|eval|expr>
-    lua_pushthread(L);  // <eval|eval|expr|co>
+    lua_pushfstring(L, "return %s", expr);   // <eval|eval|expr>
+    push_thread_value(L, co);  // <eval|eval|expr|co>
     lua_pushinteger(L, level); // <eval|eval|expr|co|evel>
     lua_call(L, 3, 2);  // <eval|boolean|res>
     if (lua_toboolean(L, -2)) {
@@ -440,8 +746,8 @@ static int evaluate(lua_State *dL) {
     }
 
     // second, try: "expr"
-    lua_pushfstring(L, "%s", lua_tostring(dL, 2));   // <eval|expr>
-    lua_pushthread(L);  // <eval|expr|co>
+    lua_pushfstring(L, "%s", expr);   // <eval|expr>
+    push_thread_value(L, co);  // <eval|expr|co>
     lua_pushinteger(L, level); // <eval|expr|co|evel>
     lua_call(L, 3, 2);  // <eval|boolean|res>
     if (lua_toboolean(L, -2)) {
@@ -457,13 +763,187 @@ static int evaluate(lua_State *dL) {
     }
 }
 
+// 在Hook里调用注入代码的函数name(version, key, line, src, f, co, level)，
+// 表达式按(断点版本, 原型, 行)缓存编译结果；成功时nresults个结果在栈顶，失败时什么也不压
+static bool call_injectcode(lua_State *L, lua_Debug *ar, const char *name, int line, const char *src, int nresults) {
+    vscdbg_t *dbg = vscdbg_get_from_state(L);
+    if (!isLua(ar->i_ci))
+        return false;
+    if (!load_injectcode(dbg, L)) {    // <err>
+        lua_pop(L, 1);  // <>
+        return false;
+    }
+    lua_getfield(L, -1, name);          // <inject|func>
+    lua_remove(L, -2);                  // <func>
+    lua_pushinteger(L, dbg->bpversion); // <func|ver>
+    lua_pushlightuserdata(L, clLvalue(ar->i_ci->func)->p);  // <func|ver|key>
+    lua_pushinteger(L, line);           // <func|ver|key|line>
+    lua_pushstring(L, src);             // <func|ver|key|line|src>
+    lua_getinfo(L, "f", ar);            // <func|ver|key|line|src|f>
+    lua_pushthread(L);                  // <func|ver|key|line|src|f|co>
+    lua_pushinteger(L, 0);              // <func|ver|key|line|src|f|co|level>
+    if (lua_pcall(L, 7, nresults, 0)) { // <err>
+        lua_pop(L, 1);  // <>
+        return false;
+    }
+    return true;
+}
+
+// 在Hook里检查条件断点是否成立，出错时当作成立
+bool dbgaux_checkcondition(lua_State *L, lua_Debug *ar, int line, const char *cond) {
+    if (!call_injectcode(L, ar, "condition", line, cond, 2))
+        return true;
+    // <ok|hit>
+    bool hit = !lua_toboolean(L, -2) || lua_toboolean(L, -1);
+    lua_pop(L, 2);  // <>
+    return hit;
+}
+
+// 在Hook里生成日志断点的消息，{}里的表达式在栈帧上求值，成功时消息在栈顶
+bool dbgaux_logmessage(lua_State *L, lua_Debug *ar, int line, const char *msg) {
+    if (!call_injectcode(L, ar, "logmessage", line, msg, 1))
+        return false;
+    if (!lua_isstring(L, -1)) {
+        lua_pop(L, 1);
+        return false;
+    }
+    return true;
+}
+
+// 同步调试器状态，单步状态需要传入单步的协程
+// (state, co) => void
+static int setdbgstate(lua_State *dL) {
+    vscdbg_t *dbg = vscdbg_get_from_state(dL);
+    int state = luaL_checkinteger(dL, 1);
+    lua_State *L = lua_touserdata(dL, 2);
+    vscdbg_set_state(dbg, state, L);
+    return 0;
+}
+
+// 设置一个源文件的断点，返回该文件的源ID，断点是{line=, condition=, hitCondition=, logMessage=}的数组
+// (path, bps) => srcid
+static int setbreakpoints(lua_State *dL) {
+    vscdbg_t *dbg = vscdbg_get_from_state(dL);
+    size_t len;
+    const char *path = luaL_checklstring(dL, 1, &len);
+    luaL_checktype(dL, 2, LUA_TTABLE);
+    int n = luaL_len(dL, 2);
+    bpline_t *bps = malloc(sizeof(bpline_t) * (n > 0 ? n : 1));
+    int i;
+    for (i = 1; i <= n; ++i) {
+        lua_geti(dL, 2, i);     // [bp]
+        lua_getfield(dL, -1, "line");       // [bp|line]
+        bps[i-1].line = lua_tointeger(dL, -1);
+        lua_getfield(dL, -2, "condition");  // [bp|line|cond]
+        const char *cond = lua_tostring(dL, -1);
+        // 简单的条件在C层求值，不支持的交给被调试虚拟机编译求值
+        bps[i-1].cond = NULL;
+        bps[i-1].condsrc = NULL;
+        if (cond && cond[0]) {
+            bps[i-1].cond = bpcond_parse(dL, cond);
+            bps[i-1].condsrc = strdup(cond);
+        }
+        lua_getfield(dL, -3, "hitCondition");   // [bp|line|cond|hitcond]
+        bpline_parsehit(&bps[i-1], lua_tostring(dL, -1));
+        lua_getfield(dL, -4, "logMessage");     // [bp|line|cond|hitcond|log]
+        const char *logmsg = lua_tostring(dL, -1);
+        bps[i-1].logmsg = logmsg ? strdup(logmsg) : NULL;
+        lua_pop(dL, 5);         // []
+    }
+    int srcid = srctable_intern(&dbg->srctable, path, len);
+    bptable_set(&dbg->bptable, srcid, bps, n);
+    dbg->bpversion++;
+    free(bps);
+    vscdbg_update_hooks(dbg);
+    lua_pushinteger(dL, srcid);
+    return 1;
+}
+
+// 取源ID对应的路径，不是文件的源返回nil
+// (srcid) => path
+static int getsource(lua_State *dL) {
+    vscdbg_t *dbg = vscdbg_get_from_state(dL);
+    size_t len;
+    const char *path = srctable_getpath(&dbg->srctable, luaL_checkinteger(dL, 1), &len);
+    if (path)
+        lua_pushlstring(dL, path, len);
+    else
+        lua_pushnil(dL);
+    return 1;
+}
+
+// 取一个请求，没有请求时block为true则等到有请求，否则返回nil；客户端断开时返回nil, true
+// (block) => msg, closed
+static int recv(lua_State *dL) {
+    vscdbg_t *dbg = vscdbg_get_from_state(dL);
+    const char *msg;
+    size_t len;
+    int r = dbg->io ? vscio_recv(dbg->io, lua_toboolean(dL, 1), &msg, &len) : VSCIO_CLOSED;
+    if (r == VSCIO_MSG) {
+        lua_pushlstring(dL, msg, len);
+        return 1;
+    }
+    lua_pushnil(dL);
+    lua_pushboolean(dL, r == VSCIO_CLOSED);
+    return 2;
+}
+
+// 发送cjson.encode_frame编码好的消息，帧已经带了Content-Length头，不用再生成Lua字符串
+// (frame, len) => void
+static int sendframe(lua_State *dL) {
+    vscdbg_t *dbg = vscdbg_get_from_state(dL);
+    luaL_checktype(dL, 1, LUA_TLIGHTUSERDATA);
+    const char *frame = lua_touserdata(dL, 1);
+    size_t len = (size_t)luaL_checkinteger(dL, 2);
+    if (dbg->io) vscio_sendframe(dbg->io, frame, len);
+    return 0;
+}
+
+// 分配一个消息序号，和捕获输出的线程共用一个计数，没有IO时返回0
+// () => seq
+static int nextseq(lua_State *dL) {
+    vscdbg_t *dbg = vscdbg_get_from_state(dL);
+    lua_pushinteger(dL, dbg->io ? (lua_Integer)vscio_next_seq(dbg->io) : 0);
+    return 1;
+}
+
+// 马上发出缓冲的消息，等到全部写出去，退出进程前调用
+// () => void
+static int flush(lua_State *dL) {
+    vscdbg_t *dbg = vscdbg_get_from_state(dL);
+    if (dbg->io) vscio_drain(dbg->io);
+    return 0;
+}
+
+// 设置客户端来不及接收时print和日志断点输出的处理方式，spillpath只对spill有用，不给时用临时目录
+// (policy, spillpath) => void
+static int setoutputpolicy(lua_State *dL) {
+    static const char *const policies[] = {"block", "drop", "spill", NULL};
+    static const int values[] = {OUTPUT_BLOCK, OUTPUT_DROP, OUTPUT_SPILL};
+    vscdbg_t *dbg = vscdbg_get_from_state(dL);
+    int policy = luaL_checkoption(dL, 1, "block", policies);
+    vscdbg_set_output_policy(dbg, values[policy], luaL_optstring(dL, 2, NULL));
+    return 0;
+}
+
 static const luaL_Reg lib[] = {
     {"addpath", addpath},
     {"runscript", runscript},
-    {"getstackframes", getstackframes},
-    {"clearvarcache", clearvarcache},
-    {"getvars", getvars},
+    {"sendstacktrace", sendstacktrace},
+    {"getthreads", getthreads},
+    {"getthread", getthread},
+    {"getthreadid", getthreadid},
+    {"prunethreads", prunethreads},
+    {"sendvars", sendvars},
     {"evaluate", evaluate},
+    {"setdbgstate", setdbgstate},
+    {"setbreakpoints", setbreakpoints},
+    {"getsource", getsource},
+    {"recv", recv},
+    {"sendframe", sendframe},
+    {"nextseq", nextseq},
+    {"flush", flush},
+    {"setoutputpolicy", setoutputpolicy},
     {NULL, NULL},
 };
 
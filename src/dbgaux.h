@@ -7,5 +7,7 @@
 #define __DBGAUX_H__
 
 int luaopen_dbgaux(lua_State *L);
+bool dbgaux_checkcondition(lua_State *L, lua_Debug *ar, int line, const char *cond);
+bool dbgaux_logmessage(lua_State *L, lua_Debug *ar, int line, const char *msg);
 
 #endif //__DBGAUX_H__
\ No newline at end of file
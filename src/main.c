@@ -4,77 +4,64 @@
  */
 #include "defines.h"
 #include "vscdbg.h"
+#include <errno.h>
+#include <signal.h>
 
 static void init_debugger(lua_State *L, const char *curpath) {
     vscdbg_t *dbg = vscdbg_new(L, curpath);
     vscdbg_attach_state(L, dbg);
-    vscdbg_new_thread(L, L);
+    // 自己运行脚本，信号不会影响别的代码，用信号让运行中的脚本马上处理暂停请求
+    vscdbg_enable_wakeup(dbg, SIGURG);
 }
 
 static void start_debugger(lua_State *L) {
     vscdbg_t *dbg = vscdbg_get_from_state(L);
+    vscdbg_open_stdio(dbg);
     vscdbg_handle_request(dbg, L);
 }
 
-static void free_debugger(lua_State *L) {
-    vscdbg_free(vscdbg_get_from_state(L));
-}
-
-//-------------------------------------------------------------
-// lua 自定义函数
-void on_userstateopen(lua_State *L) {
-}
-
-void on_userstateclose(lua_State *L) {
-}
-
-void on_userstatethread(lua_State *L, lua_State *L1) {
-    vscdbg_new_thread(L, L1);
-}
-
-void on_userstatefree(lua_State *L, lua_State *L1) {
-    vscdbg_free_thread(L, L1);
-}
-
-void on_userstateresume(lua_State *L, int nargs) {
-    vscdbg_resume_thread(L);
-}
-
-void do_writestring(lua_State *L, const void *ptr, size_t sz) {
-    if (!L) return;
-    vscdbg_t* dbg = vscdbg_get_from_state(L);
-    if (dbg) {
-        if (L == dbg->dL) {
-            // 调试器的Lua状态机，由于stdout被重定向到VSCode去了，所以只能通过stderr输出
-            fwrite(ptr, sizeof(char), sz, stderr);
-        } else {
-            // 交给调试器的Lua处理
-            lua_Debug ar;
-            if (lua_getstack(L, 1, &ar) && lua_getinfo(L, "Sl", &ar)) {
-                vscdbg_on_output(dbg, ptr, sz, ar.source, ar.currentline);
-            } else {
-                vscdbg_on_output(dbg, ptr, sz, NULL, -1);
-            }
-        }
+// 监听模式：自己运行脚本，VSCode随时可以通过socket连上来调试，断开后脚本继续运行
+static int run_listen(lua_State *L, const char *addr, int argc, const char *argv[]) {
+    vscdbg_t *dbg = vscdbg_get_from_state(L);
+    if (!vscdbg_listen(dbg, addr)) {
+        fprintf(stderr, "listen %s failed: %s\n", addr, strerror(errno));
+        return 1;
+    }
+    fprintf(stderr, "vscluadbg: listening on %s\n", addr);
+    if (luaL_loadfile(L, argv[0]) != LUA_OK) {
+        fprintf(stderr, "%s\n", lua_tostring(L, -1));
+        return 1;
     }
+    int i;
+    for (i = 1; i < argc; ++i)
+        lua_pushstring(L, argv[i]);
+    if (lua_pcall(L, argc - 1, 0, 0) != LUA_OK) {
+        fprintf(stderr, "%s\n", luaL_tolstring(L, -1, NULL));
+        return 1;
+    }
+    return 0;
 }
 
-void do_writeline(lua_State *L) {
-    if (!L) return;
-    do_writestring(L, "\n", 1);
+static void free_debugger(lua_State *L) {
+    vscdbg_free(vscdbg_get_from_state(L));
 }
 
-//-------------------------------------------------------------
-
+// vscluadbg                                由VSCode启动，通过标准输入输出通讯
+// vscluadbg -listen <addr> <script> [args]  运行脚本并监听addr，addr为unix:路径或[127.0.0.1:]端口
 int main(int argc, char const *argv[]) {
     const char *curpath = argv[0];
+    int ret = 0;
     lua_State *L = luaL_newstate();
     luaL_openlibs(L);
 
     init_debugger(L, curpath);
-    start_debugger(L);
+    if (argc >= 4 && strcmp(argv[1], "-listen") == 0) {
+        ret = run_listen(L, argv[2], argc - 3, argv + 3);
+    } else {
+        start_debugger(L);
+    }
 
     free_debugger(L);
     lua_close(L);
-    return 0;  
+    return ret;
 }
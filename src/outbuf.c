@@ -0,0 +1,34 @@
+/**
+ * 输出缓冲
+ * by code
+ */
+#include "outbuf.h"
+
+void outbuf_init(outbuf_t *ob) {
+    memset(ob, 0, sizeof(outbuf_t));
+}
+
+void outbuf_free(outbuf_t *ob) {
+    free(ob->buf);
+    memset(ob, 0, sizeof(outbuf_t));
+}
+
+char *outbuf_reserve(outbuf_t *ob, size_t sz) {
+    if (ob->len + sz > ob->cap) {
+        size_t cap = ob->cap ? ob->cap : 256;
+        while (cap < ob->len + sz) cap *= 2;
+        ob->buf = realloc(ob->buf, cap);
+        ob->cap = cap;
+    }
+    return ob->buf + ob->len;
+}
+
+void outbuf_append(outbuf_t *ob, const char *str, size_t sz) {
+    memcpy(outbuf_reserve(ob, sz), str, sz);
+    ob->len += sz;
+}
+
+void outbuf_clear(outbuf_t *ob, double now) {
+    ob->len = 0;
+    ob->time = now;
+}
@@ -0,0 +1,28 @@
+/**
+ * 输出缓冲：print和日志断点的输出先攒在这里，合并成一个output事件再发给VSCode
+ * by code
+ */
+#ifndef __OUTBUF_H__
+#define __OUTBUF_H__
+#include "defines.h"
+
+typedef struct outbuf {
+    char *buf;
+    size_t len;
+    size_t cap;
+    int srcid;                  // 缓冲里的输出所在的源ID，0表示没有源
+    int line;                   // 缓冲里的输出所在的行
+    const char *path;           // 源ID对应的路径，在主线程取好，其他线程编码事件时不用查源文件表
+    double time;                // 上一次发出的时间，毫秒
+} outbuf_t;
+
+void outbuf_init(outbuf_t *ob);
+void outbuf_free(outbuf_t *ob);
+// 追加一段输出
+void outbuf_append(outbuf_t *ob, const char *str, size_t sz);
+// 保证后面至少还有sz字节的空间，返回写的位置，写完后调用者自己增加len
+char *outbuf_reserve(outbuf_t *ob, size_t sz);
+// 缓冲已经发出去了，清空并记下发出的时间
+void outbuf_clear(outbuf_t *ob, double now);
+
+#endif // __OUTBUF_H__
@@ -0,0 +1,215 @@
+/**
+ * 源文件表：源文件路径 <-> 源ID
+ * by code
+ */
+#include "srctable.h"
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#define SRCTABLE_MINSIZE 16
+#define SRCNAME_MINSIZE 64
+// 源名缓存的上限，被调试程序不断加载新文件时清空重来
+#define SRCNAME_MAXCOUNT 4096
+
+static unsigned int hash_path(const char *path, size_t len) {
+    unsigned int h = (unsigned int)len;
+    size_t i;
+    for (i = 0; i < len; ++i)
+        h ^= ((h << 5) + (h >> 2) + (unsigned char)path[i]);
+    return h;
+}
+
+// 规范化路径：相对路径以当前目录为基准，去掉多余的/、.和..，只做字符串处理不访问文件系统，
+// 这样VSC传来的路径和被调试程序加载时用的路径才能对得上。返回的路径需要调用者释放
+static char *normalize_path(const char *path, size_t len, size_t *outlen) {
+#ifdef _WIN32
+    char *out = malloc(len + 1);
+    memcpy(out, path, len);
+    out[len] = '\0';
+    *outlen = len;
+    return out;
+#else
+    char cwd[512];
+    size_t cwdlen = 0;
+    if (len == 0 || path[0] != '/') {
+        if (getcwd(cwd, sizeof(cwd))) cwdlen = strlen(cwd);
+    }
+    char *out = malloc(cwdlen + len + 3);
+    size_t n = 0;
+    if (cwdlen == 0 && (len == 0 || path[0] != '/')) {
+        // 取不到当前目录，保持相对路径
+        memcpy(out, path, len);
+        out[len] = '\0';
+        *outlen = len;
+        return out;
+    }
+    out[n++] = '/';
+
+    // 依次处理当前目录和路径的每一段
+    const char *parts[2] = {cwd, path};
+    size_t lens[2] = {cwdlen, len};
+    int k;
+    for (k = 0; k < 2; ++k) {
+        const char *s = parts[k], *e = s + lens[k];
+        while (s < e) {
+            const char *p = s;
+            while (p < e && *p != '/') p++;
+            size_t sz = p - s;
+            if (sz == 0 || (sz == 1 && s[0] == '.')) {
+                // 空段和.直接跳过
+            } else if (sz == 2 && s[0] == '.' && s[1] == '.') {
+                // 回到上一级
+                if (n > 1) {
+                    n--;
+                    while (n > 1 && out[n-1] != '/') n--;
+                }
+            } else {
+                memcpy(out + n, s, sz);
+                n += sz;
+                out[n++] = '/';
+            }
+            s = p + 1;
+        }
+    }
+    if (n > 1) n--;     // 去掉最后的/
+    out[n] = '\0';
+    *outlen = n;
+    return out;
+#endif
+}
+
+static int find_path(srctable_t *st, const char *path, size_t len, unsigned int h) {
+    if (!st->size) return 0;
+    int id = st->buckets[h & (st->size - 1)];
+    for (; id; id = st->entries[id].next) {
+        srcentry_t *se = &st->entries[id];
+        if (se->hash == h && se->len == len && memcmp(se->path, path, len) == 0)
+            return id;
+    }
+    return 0;
+}
+
+static void rehash(srctable_t *st, int size) {
+    int *buckets = calloc(size, sizeof(int));
+    int id;
+    for (id = 1; id <= st->count; ++id) {
+        srcentry_t *se = &st->entries[id];
+        se->next = buckets[se->hash & (size - 1)];
+        buckets[se->hash & (size - 1)] = id;
+    }
+    free(st->buckets);
+    st->buckets = buckets;
+    st->size = size;
+}
+
+// 加入一个已经规范化的路径，路径的内存交给源文件表
+static int add_path(srctable_t *st, char *path, size_t len) {
+    unsigned int h = hash_path(path, len);
+    int id = find_path(st, path, len, h);
+    if (id) {
+        free(path);
+        return id;
+    }
+    if (st->count + 1 >= st->cap) {
+        st->cap = st->cap ? st->cap * 2 : SRCTABLE_MINSIZE;
+        st->entries = realloc(st->entries, st->cap * sizeof(srcentry_t));
+    }
+    id = ++st->count;
+    srcentry_t *se = &st->entries[id];
+    se->hash = h;
+    se->len = len;
+    se->path = path;
+    if (st->count >= st->size) {
+        rehash(st, st->size ? st->size * 2 : SRCTABLE_MINSIZE);
+    } else {
+        se->next = st->buckets[h & (st->size - 1)];
+        st->buckets[h & (st->size - 1)] = id;
+    }
+    return id;
+}
+
+static void clear_names(srctable_t *st) {
+    int i;
+    for (i = 0; i < st->nsize; ++i) {
+        free(st->names[i].name);
+        st->names[i].name = NULL;
+        st->names[i].ts = NULL;
+    }
+    st->ncount = 0;
+}
+
+static unsigned int hash_name(const TString *ts) {
+    size_t h = (size_t)ts;
+    return (unsigned int)((h >> 3) ^ (h >> 17)) * 2654435761u;
+}
+
+static srcname_t *find_name_slot(srcname_t *names, int nsize, const TString *ts) {
+    unsigned int i = hash_name(ts) & (nsize - 1);
+    while (names[i].ts && names[i].ts != ts)
+        i = (i + 1) & (nsize - 1);
+    return &names[i];
+}
+
+static void resize_names(srctable_t *st, int nsize) {
+    srcname_t *names = calloc(nsize, sizeof(srcname_t));
+    int i;
+    for (i = 0; i < st->nsize; ++i) {
+        if (st->names[i].ts)
+            *find_name_slot(names, nsize, st->names[i].ts) = st->names[i];
+    }
+    free(st->names);
+    st->names = names;
+    st->nsize = nsize;
+}
+
+void srctable_init(srctable_t *st) {
+    memset(st, 0, sizeof(srctable_t));
+}
+
+void srctable_free(srctable_t *st) {
+    int id;
+    for (id = 1; id <= st->count; ++id)
+        free(st->entries[id].path);
+    free(st->entries);
+    free(st->buckets);
+    clear_names(st);
+    free(st->names);
+    memset(st, 0, sizeof(srctable_t));
+}
+
+int srctable_intern(srctable_t *st, const char *path, size_t len) {
+    size_t n;
+    char *norm = normalize_path(path, len, &n);
+    return add_path(st, norm, n);
+}
+
+int srctable_getid(srctable_t *st, const TString *source) {
+    if (!source) return 0;
+    const char *name = getstr(source);
+    size_t len = tsslen(source);
+    if (len == 0 || name[0] != '@') return 0;
+
+    if (st->ncount >= SRCNAME_MAXCOUNT) clear_names(st);
+    if (st->ncount * 2 >= st->nsize)
+        resize_names(st, st->nsize ? st->nsize * 2 : SRCNAME_MINSIZE);
+    srcname_t *sn = find_name_slot(st->names, st->nsize, source);
+    // 字符串被回收后地址可能被新的字符串复用
+    if (sn->ts && sn->len == len && memcmp(sn->name, name, len) == 0)
+        return sn->id;
+
+    if (!sn->ts) st->ncount++;
+    free(sn->name);
+    sn->ts = source;
+    sn->len = len;
+    sn->name = malloc(len);
+    memcpy(sn->name, name, len);
+    sn->id = srctable_intern(st, name + 1, len - 1);
+    return sn->id;
+}
+
+const char *srctable_getpath(srctable_t *st, int id, size_t *len) {
+    if (id <= 0 || id > st->count) return NULL;
+    if (len) *len = st->entries[id].len;
+    return st->entries[id].path;
+}
@@ -0,0 +1,48 @@
+/**
+ * 源文件表：源文件路径 <-> 源ID
+ * by code
+ */
+#ifndef __SRCTABLE_H__
+#define __SRCTABLE_H__
+#include "defines.h"
+#include "lobject.h"
+
+// 一个源文件，数组下标就是源ID，0号不用，表示不是文件的源
+typedef struct srcentry {
+    int next;                   // 哈希链，下一个源ID，0表示结束
+    unsigned int hash;          // 路径的哈希值
+    size_t len;                 // 路径长度
+    char *path;                 // 规范化后的路径
+} srcentry_t;
+
+// 被调试虚拟机的源名字符串缓存：TString -> 源ID
+typedef struct srcname {
+    const TString *ts;          // 源名字符串，NULL表示空槽
+    size_t len;                 // 以下两项用于校验字符串地址是否被复用
+    char *name;
+    int id;                     // 源ID
+} srcname_t;
+
+// 源文件表，源ID一经分配就不会改变
+typedef struct srctable {
+    srcentry_t *entries;        // 源文件数组
+    int count;                  // 源文件数量，也是最大的源ID
+    int cap;                    // 数组容量
+    int *buckets;               // 哈希桶，存源ID
+    int size;                   // 桶的数量，总是2的幂
+    srcname_t *names;           // 源名缓存，开放寻址
+    int nsize;                  // 源名缓存的容量，总是2的幂
+    int ncount;                 // 源名缓存的数量
+} srctable_t;
+
+void srctable_init(srctable_t *st);
+void srctable_free(srctable_t *st);
+
+// 取路径的源ID，路径会先规范化，不存在时新分配一个
+int srctable_intern(srctable_t *st, const char *path, size_t len);
+// 取源名(Proto.source)的源ID，只有@开头的源才是文件，其他的返回0
+int srctable_getid(srctable_t *st, const TString *source);
+// 取源ID对应的规范化路径，无效的ID返回NULL
+const char *srctable_getpath(srctable_t *st, int id, size_t *len);
+
+#endif // __SRCTABLE_H__
@@ -0,0 +1,51 @@
+/**
+ * Lua的自定义函数：luaconf.h把线程创建、释放、恢复以及print的输出接到这里，
+ * 宿主程序嵌入调试器时需要和修改过的Lua一起链接
+ * by code
+ */
+#include "defines.h"
+#include "vscdbg.h"
+
+void on_userstateopen(lua_State *L) {
+}
+
+void on_userstateclose(lua_State *L) {
+}
+
+void on_userstatethread(lua_State *L, lua_State *L1) {
+    vscdbg_new_thread(L, L1);
+}
+
+void on_userstatefree(lua_State *L, lua_State *L1) {
+    vscdbg_free_thread(L, L1);
+}
+
+void on_userstateresume(lua_State *L, int nargs) {
+}
+
+void do_writestring(lua_State *L, const void *ptr, size_t sz) {
+    if (!L) return;
+    vscdbg_t* dbg = vscdbg_get_from_state(L);
+    if (dbg) {
+        if (L == dbg->dL) {
+            // 调试器的Lua状态机，由于stdout被重定向到VSCode去了，所以只能通过stderr输出
+            fwrite(ptr, sizeof(char), sz, stderr);
+        } else if (vscdbg_is_detached(dbg)) {
+            // 没有客户端连着，直接输出，不用取源和行
+            fwrite(ptr, sizeof(char), sz, stdout);
+        } else {
+            // 放进调试器的输出缓冲，合并后发给VSCode
+            vscdbg_on_output(dbg, L, ptr, sz);
+        }
+    } else {
+        // 没有挂调试器的状态机，照常输出
+        fwrite(ptr, sizeof(char), sz, stdout);
+    }
+}
+
+void do_writeline(lua_State *L) {
+    if (!L) return;
+    do_writestring(L, "\n", 1);
+    vscdbg_t* dbg = vscdbg_get_from_state(L);
+    if (!dbg || vscdbg_is_detached(dbg)) fflush(stdout);
+}
@@ -0,0 +1,62 @@
+/**
+ * 变量句柄表
+ * by code
+ */
+#include "varcache.h"
+
+// 锚表在注册表里的键是句柄表的地址，锚表是弱值表
+
+void varcache_init(varcache_t *vc) {
+    memset(vc, 0, sizeof(varcache_t));
+    vc->gen = 1;
+}
+
+void varcache_free(varcache_t *vc, lua_State *L) {
+    varcache_reset(vc, L);
+    memset(vc, 0, sizeof(varcache_t));
+}
+
+void varcache_reset(varcache_t *vc, lua_State *L) {
+    vc->gen++;
+    if (vc->count) {
+        luaL_checkstack(L, 1, NULL);
+        lua_pushnil(L);
+        lua_rawsetp(L, LUA_REGISTRYINDEX, vc);
+        vc->count = 0;
+    }
+}
+
+lua_Integer varcache_add(varcache_t *vc, lua_State *L, int stkidx) {
+    if (vc->count >= VARCACHE_MAXCOUNT)
+        return 0;
+    stkidx = lua_absindex(L, stkidx);
+    luaL_checkstack(L, 3, NULL);
+    if (lua_rawgetp(L, LUA_REGISTRYINDEX, vc) != LUA_TTABLE) {   // <a>
+        lua_pop(L, 1);  // <>
+        lua_newtable(L);    // <a>
+        lua_createtable(L, 0, 1);   // <a|mt>
+        lua_pushliteral(L, "v");    // <a|mt|v>
+        lua_setfield(L, -2, "__mode");  // <a|mt>
+        lua_setmetatable(L, -2);    // <a>
+        lua_pushvalue(L, -1);   // <a|a>
+        lua_rawsetp(L, LUA_REGISTRYINDEX, vc);  // <a>
+    }
+    lua_pushvalue(L, stkidx);   // <a|v>
+    lua_rawseti(L, -2, ++vc->count);    // <a>
+    lua_pop(L, 1);  // <>
+    return (vc->gen << VARCACHE_INDEXBITS) | vc->count;
+}
+
+bool varcache_push(varcache_t *vc, lua_State *L, lua_Integer handle) {
+    int idx = (int)(handle & VARCACHE_MAXCOUNT);
+    if ((handle >> VARCACHE_INDEXBITS) != vc->gen || idx < 1 || idx > vc->count)
+        return false;
+    luaL_checkstack(L, 2, NULL);
+    lua_rawgetp(L, LUA_REGISTRYINDEX, vc);  // <a>
+    if (lua_rawgeti(L, -1, idx) == LUA_TNIL) {  // <a|v>
+        lua_pop(L, 2);  // <>
+        return false;
+    }
+    lua_remove(L, -2);  // <v>
+    return true;
+}
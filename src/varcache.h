@@ -0,0 +1,31 @@
+/**
+ * 变量句柄表：客户端展开的表在暂停期间用句柄引用。
+ * 句柄引用的值放在被调试虚拟机注册表里的一个弱值锚表中，锚表不延长值的生命周期，
+ * 暂停期间也不用停掉GC；求值的表达式改掉了引用，值被回收后句柄就报告变量无效；
+ * 每次暂停用一个新的代，句柄带着代号，换代时去掉锚表，以前的句柄都失效
+ * by code
+ */
+#ifndef __VARCACHE_H__
+#define __VARCACHE_H__
+#include "defines.h"
+
+// 句柄 = 代号 << VARCACHE_INDEXBITS | (下标 + 1)
+#define VARCACHE_INDEXBITS 24
+#define VARCACHE_MAXCOUNT ((1 << VARCACHE_INDEXBITS) - 1)
+
+typedef struct varcache {
+    lua_Integer gen;            // 当前的代号，从1开始
+    int count;                  // 这一代分配的句柄数，也是锚表的长度
+} varcache_t;
+
+void varcache_init(varcache_t *vc);
+// 去掉锚表，宿主关闭被调试虚拟机之前调用
+void varcache_free(varcache_t *vc, lua_State *L);
+// 开始新的一代，去掉锚表，以前的句柄都失效
+void varcache_reset(varcache_t *vc, lua_State *L);
+// 给L上stkidx位置的值分配一个句柄，满了返回0
+lua_Integer varcache_add(varcache_t *vc, lua_State *L, int stkidx);
+// 把句柄引用的值压到L的栈顶，句柄无效或值已经被回收时什么都不压，返回false
+bool varcache_push(varcache_t *vc, lua_State *L, lua_Integer handle);
+
+#endif // __VARCACHE_H__
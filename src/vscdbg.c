@@ -5,28 +5,44 @@
 #include "vscdbg.h"
 #include "dbgaux.h"
 #include "lstate.h"
+#include "ldo.h"
+#include "lgc.h"
+#include "dapjson.h"
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+
+// 线程信息必须放得进额外空间
+typedef char vscthread_must_fit_extraspace[sizeof(vscthread_t) <= LUA_EXTRASPACE ? 1 : -1];
 
 // 高度器脚本
 static const char *LUA_DEBUGGER = "/../debugger.lua";
 // 全局函数
 static const char *ON_START = "on_start";
 static const char *ON_STOP = "on_stop";
-static const char *ON_NEW_THREAD = "on_new_thread";
-static const char *ON_FREE_THREAD = "on_free_thread";
-static const char *ON_RESUME_THREAD = "on_resume_thread";
-static const char *ON_CALL = "on_call";
-static const char *ON_RETURN = "on_return";
 static const char *ON_LINE = "on_line";
 static const char *HANDLE_REQUEST = "handle_request";
-static const char *ON_OUTPUT = "on_output";
+static const char *HANDLE_PENDING = "handle_pending";
+static const char *ON_LISTEN = "on_listen";
+
+// print和日志断点的输出最多缓冲这么久，或这么多字节；到时间由定时线程发出
+#define OUTPUT_FLUSH_MS 50
+#define OUTPUT_FLUSH_SIZE (64 * 1024)
 
-// 检查调用，返LUA_OK表示成功，其他表示失败，错误对象在栈顶
+// 信号处理函数里用到的调试器，只有调用了vscdbg_enable_wakeup才有
+static vscdbg_t *wakeup_dbg = NULL;
+
+// 检查调用，返LUA_OK表示成功，其他表示失败，错误对象在栈顶；
+// 调试器脚本每次被调用时发出的消息作为一批，调用结束后一起发出去
 static void check_call(lua_State *L, int error, const char *func) {
+    vscdbg_t *dbg = vscdbg_get_from_state(L);
     if (error) {
-        vscdbg_t *dbg = vscdbg_get_from_state(L);
         vscdbg_debuglog(dbg, "%s error: %s\n", func, lua_tostring(L, -1));
         lua_pop(L, 1);
     }
+    if (dbg->io) vscio_flush(dbg->io);
 }
 
 // 运行调试器的Lua脚本
@@ -47,82 +63,436 @@ static void vscdbg_run_luadebbuer(vscdbg_t *dbg) {
     }
 }
 
-// 计算调用层级
-static int get_call_level(lua_State *L) {
+// 遍历CallInfo链表计算调用层级
+static int get_call_level(lua_State *L, CallInfo *endci) {
     int level = 0;
     CallInfo *ci = &L->base_ci;
-    for (; ci && ci != L->ci; ci = ci->next) {
+    for (; ci && ci != endci; ci = ci->next) {
         level++;
     }
     return level;
 }
 
-static void on_new_thread(vscdbg_t *dbg, lua_State *L) {
-    if (lua_getglobal(dbg->dL, ON_NEW_THREAD) == LUA_TFUNCTION) {
-        lua_pushlightuserdata(dbg->dL, L);
-        check_call(dbg->dL, lua_pcall(dbg->dL, 1, 0, 0), ON_NEW_THREAD);
-    } else {
-        fprintf(stderr, "%s must be a function\n", ON_NEW_THREAD);
+static double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// 以下输出相关的函数调用前都要锁住outlock，主线程和定时发出输出的线程都会调用
+
+// 把一段输出编码成output事件，不经过调试器脚本直接放进写队列；path为NULL时不带源，line小于0时不带行
+static void post_output(vscdbg_t *dbg, const char *category, const char *s, size_t len, const char *path, int line) {
+    if (!dbg->io) return;
+    outbuf_t *ob = &dbg->eventbuf;
+    outbuf_clear(ob, 0);
+    dapjson_event(ob, vscio_next_seq(dbg->io), "output");
+    dapjson_lit(ob, "{\"category\":");
+    dapjson_string(ob, category, strlen(category));
+    dapjson_lit(ob, ",\"output\":");
+    dapjson_string(ob, s, len);
+    if (path) {
+        dapjson_lit(ob, ",\"source\":{\"path\":");
+        dapjson_string(ob, path, strlen(path));
+        dapjson_lit(ob, "}");
+    }
+    if (line >= 0) {
+        dapjson_lit(ob, ",\"line\":");
+        dapjson_integer(ob, line);
     }
+    dapjson_lit(ob, "}");
+    dapjson_end(ob);
+    vscio_post(dbg->io, ob->buf, ob->len);
 }
 
-static void on_free_thread(vscdbg_t *dbg, lua_State *L) {
-    if (lua_getglobal(dbg->dL, ON_FREE_THREAD) == LUA_TFUNCTION) {
-        lua_pushlightuserdata(dbg->dL, L);
-        check_call(dbg->dL, lua_pcall(dbg->dL, 1, 0, 0), ON_FREE_THREAD);
-    } else {
-        fprintf(stderr, "%s must be a function\n", ON_FREE_THREAD);
+// 发一行调试器自己的提示
+static void send_notice(vscdbg_t *dbg, const char *msg) {
+    post_output(dbg, "console", msg, strlen(msg), NULL, -1);
+}
+
+static int count_lines(const char *s, size_t len) {
+    int n = 0;
+    const char *e = s + len;
+    while ((s = memchr(s, '\n', e - s)) != NULL) {
+        n++;
+        s++;
     }
+    return n;
 }
 
-static void on_resume_thread(vscdbg_t *dbg, lua_State *L) {
-    if (lua_getglobal(dbg->dL, ON_RESUME_THREAD) == LUA_TFUNCTION) {
-        lua_pushlightuserdata(dbg->dL, L);
-        check_call(dbg->dL, lua_pcall(dbg->dL, 1, 0, 0), ON_RESUME_THREAD);
-    } else {
-        fprintf(stderr, "%s must be a function\n", ON_RESUME_THREAD);
+// 写队列又有空间了，报告之前丢掉或转存了多少行
+static void report_skipped(vscdbg_t *dbg) {
+    char msg[1024];
+    if (dbg->dropped) {
+        snprintf(msg, sizeof(msg), "[%d lines dropped: the client was not reading output fast enough]\n", dbg->dropped);
+        dbg->dropped = 0;
+        send_notice(dbg, msg);
+    }
+    if (dbg->spilled) {
+        fflush(dbg->spill);
+        snprintf(msg, sizeof(msg), "[%d lines written to %s: the client was not reading output fast enough]\n",
+            dbg->spilled, dbg->spillpath);
+        dbg->spilled = 0;
+        send_notice(dbg, msg);
     }
 }
 
-static void on_call(vscdbg_t *dbg, lua_State *L, lua_Debug *ar) {
-    if (lua_getglobal(dbg->dL, ON_CALL) == LUA_TFUNCTION) {
-        lua_getinfo(L, "nSl", ar);
-        lua_pushlightuserdata(dbg->dL, L);
-        lua_pushstring(dbg->dL, ar->source);
-        lua_pushstring(dbg->dL, ar->what);
-        lua_pushstring(dbg->dL, ar->name);
-        lua_pushinteger(dbg->dL, ar->currentline);
-        lua_pushinteger(dbg->dL, get_call_level(L));
-        check_call(dbg->dL, lua_pcall(dbg->dL, 6, 0, 0), ON_CALL);
+static bool open_spill(vscdbg_t *dbg) {
+    if (!dbg->spill && dbg->spillpath) {
+        dbg->spill = fopen(dbg->spillpath, "a");
+        if (!dbg->spill) {
+            fprintf(stderr, "open %s failed, output will be dropped\n", dbg->spillpath);
+            free(dbg->spillpath);
+            dbg->spillpath = NULL;
+        }
+    }
+    return dbg->spill != NULL;
+}
+
+// 写队列满了时按策略处理缓冲的输出，返回true表示不用再发给客户端
+static bool skip_output(vscdbg_t *dbg, outbuf_t *ob) {
+    if (dbg->outpolicy == OUTPUT_BLOCK || !dbg->io)
+        return false;
+    if (!vscio_wfull(dbg->io)) {
+        if (dbg->dropped || dbg->spilled) report_skipped(dbg);
+        return false;
+    }
+    int n = count_lines(ob->buf, ob->len);
+    if (dbg->outpolicy == OUTPUT_SPILL && open_spill(dbg)) {
+        fwrite(ob->buf, 1, ob->len, dbg->spill);
+        dbg->spilled += n;
     } else {
-        fprintf(stderr, "%s must be a function\n", ON_CALL);
+        dbg->dropped += n;
+    }
+    return true;
+}
+
+void vscdbg_set_output_policy(vscdbg_t *dbg, int policy, const char *spillpath) {
+    char path[512];
+    if (!spillpath) {
+        const char *tmp = getenv("TMPDIR");
+        snprintf(path, sizeof(path), "%s/vscluadbg-%d.out", tmp && *tmp ? tmp : "/tmp", (int)getpid());
+        spillpath = path;
+    }
+    pthread_mutex_lock(&dbg->outlock);
+    if (dbg->spill && (!dbg->spillpath || strcmp(dbg->spillpath, spillpath) != 0)) {
+        fclose(dbg->spill);
+        dbg->spill = NULL;
+    }
+    free(dbg->spillpath);
+    dbg->spillpath = strdup(spillpath);
+    dbg->outpolicy = policy;
+    pthread_mutex_unlock(&dbg->outlock);
+    // 捕获的fd 1和2在读线程里发出，按同样的策略处理
+    capture_set_policy(&dbg->capture, policy != OUTPUT_BLOCK, policy == OUTPUT_SPILL ? spillpath : NULL);
+}
+
+// 把缓冲的日志作为一个output事件发出去
+static void flush_log(vscdbg_t *dbg) {
+    outbuf_t *ob = &dbg->logbuf;
+    if (!skip_output(dbg, ob))
+        post_output(dbg, "console", ob->buf, ob->len, ob->path, ob->path ? ob->line : -1);
+    outbuf_clear(ob, now_ms());
+}
+
+// 把缓冲的print输出作为一个output事件发出去
+static void flush_print(vscdbg_t *dbg) {
+    outbuf_t *ob = &dbg->outbuf;
+    if (!skip_output(dbg, ob))
+        post_output(dbg, "stdout", ob->buf, ob->len, ob->path, ob->line);
+    outbuf_clear(ob, now_ms());
+}
+
+// 把缓冲的输出都发出去，暂停、脚本结束前调用。两个缓冲同时只有一个有内容，输出的顺序不会乱
+void vscdbg_flush_output(vscdbg_t *dbg) {
+    pthread_mutex_lock(&dbg->outlock);
+    if (dbg->logbuf.len) flush_log(dbg);
+    if (dbg->outbuf.len) flush_print(dbg);
+    if ((dbg->dropped || dbg->spilled) && dbg->io && !vscio_wfull(dbg->io)) report_skipped(dbg);
+    pthread_mutex_unlock(&dbg->outlock);
+    // 捕获的输出直接放进写队列，先把缓冲的消息交出去，保持顺序
+    if (dbg->capture.started) {
+        vscio_flush(dbg->io);
+        capture_drain(&dbg->capture);
+    }
+}
+
+static bool need_flush(outbuf_t *ob) {
+    return ob->len && (ob->len >= OUTPUT_FLUSH_SIZE || now_ms() - ob->time >= OUTPUT_FLUSH_MS);
+}
+
+// 缓冲的输出到时间了就发出去；print只发写完了的行
+static void check_flush_output(vscdbg_t *dbg) {
+    if (need_flush(&dbg->logbuf)) flush_log(dbg);
+    if (dbg->outlinestart && need_flush(&dbg->outbuf)) flush_print(dbg);
+}
+
+// 缓冲的输出最晚该在什么时候发出，没有缓冲的输出时返回0
+static double flush_due(vscdbg_t *dbg) {
+    double due = 0;
+    if (dbg->logbuf.len)
+        due = dbg->logbuf.time + OUTPUT_FLUSH_MS;
+    if (dbg->outbuf.len && (!due || dbg->outbuf.time + OUTPUT_FLUSH_MS < due))
+        due = dbg->outbuf.time + OUTPUT_FLUSH_MS;
+    return due;
+}
+
+// 定时发出缓冲的输出：主线程只在下一次输出时检查时间，print之后马上阻塞在C函数里(os.execute、
+// socket等待)的话，最后几行会一直留在缓冲里，这个线程到时间就替它发出去
+static void *flush_thread(void *ud) {
+    vscdbg_t *dbg = ud;
+    pthread_mutex_lock(&dbg->outlock);
+    while (!dbg->flushquit) {
+        double due = flush_due(dbg);
+        double now = now_ms();
+        if (due && now >= due) {
+            check_flush_output(dbg);
+            // print的一行还没写完，过一会再看
+            due = flush_due(dbg);
+            if (due && due <= now) due = now + OUTPUT_FLUSH_MS;
+        }
+        if (!due) {
+            pthread_cond_wait(&dbg->outcond, &dbg->outlock);
+        } else {
+            struct timespec ts;
+            ts.tv_sec = (time_t)(due / 1000);
+            ts.tv_nsec = (long)((due - ts.tv_sec * 1000.0) * 1000000);
+            if (ts.tv_nsec >= 1000000000) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&dbg->outcond, &dbg->outlock, &ts);
+        }
+    }
+    pthread_mutex_unlock(&dbg->outlock);
+    return NULL;
+}
+
+// 有了IO之后启动定时线程，启动失败时输出只在下一次输出、暂停和结束时发出
+static void start_flush_thread(vscdbg_t *dbg) {
+    if (pthread_create(&dbg->flushthread, NULL, flush_thread, dbg) == 0)
+        dbg->hasflushthread = true;
+    else
+        fprintf(stderr, "start output flush thread failed: %s\n", strerror(errno));
+}
+
+// 日志断点的一行输出放进缓冲，和缓冲里的不是同一位置时先把缓冲发出去，每个output事件只有一个位置
+static void append_log(vscdbg_t *dbg, int srcid, int line, const char *str, size_t sz) {
+    outbuf_t *ob = &dbg->logbuf;
+    pthread_mutex_lock(&dbg->outlock);
+    // 先发出缓冲的print输出，保持输出的顺序
+    if (dbg->outbuf.len) flush_print(dbg);
+    if (ob->len && (ob->srcid != srcid || ob->line != line))
+        flush_log(dbg);
+    if (!ob->len) {
+        ob->srcid = srcid;
+        ob->line = line;
+        ob->path = srctable_getpath(&dbg->srctable, srcid, NULL);
+        // 通知定时线程有了新的输出
+        pthread_cond_signal(&dbg->outcond);
+    }
+    outbuf_append(ob, str, sz);
+    outbuf_append(ob, "\n", 1);
+    check_flush_output(dbg);
+    pthread_mutex_unlock(&dbg->outlock);
+}
+
+static bool is_stepping(vscdbg_t *dbg) {
+    return dbg->state == ST_STEP_OVER || dbg->state == ST_STEP_IN || dbg->state == ST_STEP_OUT;
+}
+
+static void dbg_hook(lua_State *L, lua_Debug *ar);
+
+// 取ci的调用层级：线程记住最近一次的ci和层级，在call/return事件中增量维护。
+// 出错展开的栈帧没有return事件，关掉Hook期间也没有事件，此时ci对不上或不可信，重新遍历一次
+static int call_level(lua_State *L, CallInfo *ci) {
+    vscthread_t *th = vscdbg_get_thread(L);
+    ptrdiff_t func = savestack(L, ci->func);
+    if ((th->mask & LUA_MASKCALL) && th->ci == ci && th->func == func)
+        return th->level;
+    CallInfo *prev = ci->previous;
+    if ((th->mask & LUA_MASKCALL) && prev && th->ci == prev && th->func == savestack(L, prev->func))
+        th->level++;
+    else
+        th->level = get_call_level(L, ci);
+    th->ci = ci;
+    th->func = func;
+    return th->level;
+}
+
+// 函数返回，层级回到调用者
+static int return_level(lua_State *L, CallInfo *ci) {
+    vscthread_t *th = vscdbg_get_thread(L);
+    int level = call_level(L, ci);
+    th->ci = ci->previous;
+    th->func = savestack(L, ci->previous->func);
+    th->level = level - 1;
+    return th->level;
+}
+
+// 单步时，线程L执行到层级level是否要停下来
+static bool step_hit(vscdbg_t *dbg, lua_State *L, int level) {
+    switch (dbg->state) {
+    case ST_STEP_IN:
+        return true;
+    case ST_STEP_OVER:
+        return L == dbg->stepL && level <= dbg->steplevel;
+    case ST_STEP_OUT:
+        return L == dbg->stepL && level < dbg->steplevel;
+    default:
+        return false;
     }
 }
 
-static void on_return(vscdbg_t *dbg, lua_State *L, lua_Debug *ar) {
-    if (lua_getglobal(dbg->dL, ON_RETURN) == LUA_TFUNCTION) {
-        lua_getinfo(L, "nSl", ar);
+// 函数ci里面是否有断点
+static bool has_breakpoints(vscdbg_t *dbg, CallInfo *ci) {
+    return dbg->bptable.nlines && isLua(ci) &&
+        bptable_getproto(&dbg->bptable, clLvalue(ci->func)->p)->lines;
+}
+
+// 被调试程序运行中是否有请求等着处理；暂停时请求由handle_request处理。
+// 监听模式下客户端连上来之前被调试程序就在运行了，所以初始状态也要处理
+static bool has_pending(vscdbg_t *dbg) {
+    return dbg->io && vscio_pending(dbg->io) && dbg->state != ST_PAUSE && dbg->state != ST_TERMINATED;
+}
+
+// 计算线程L在函数ci(层级为level)中需要的Hook掩码：
+// 运行时没有断点不需要Hook；否则总是需要call/return事件来跟踪当前函数，
+// 行事件只在有断点的函数里，或单步可能停下来的层级上才打开；
+// 有请求没处理时打开计数事件，下一条指令就进入Hook；没有客户端时除此之外什么都不要
+static int calc_hook_mask(vscdbg_t *dbg, lua_State *L, CallInfo *ci, int level) {
+    int mask = has_pending(dbg) ? LUA_MASKCOUNT : 0;
+    if (vscdbg_is_detached(dbg))
+        return mask;
+    if (!is_stepping(dbg) && (dbg->state != ST_RUNNING || !dbg->bptable.nlines))
+        return mask;
+    if (step_hit(dbg, L, level) || has_breakpoints(dbg, ci))
+        return mask | LUA_MASKCALL | LUA_MASKRET | LUA_MASKLINE;
+    return mask | LUA_MASKCALL | LUA_MASKRET;
+}
+
+static void set_hook_mask(lua_State *L, int mask) {
+    vscthread_t *th = vscdbg_get_thread(L);
+    if (th->mask != mask) {
+        th->mask = mask;
+        lua_sethook(L, mask ? dbg_hook : NULL, mask, 1);
+        // 设置的同时可能收到了请求，信号处理函数打开的计数事件被覆盖了，这里补上
+        if (!(mask & LUA_MASKCOUNT) && has_pending(th->dbg)) {
+            th->mask = mask | LUA_MASKCOUNT;
+            lua_sethook(L, dbg_hook, th->mask, 1);
+        }
+    }
+}
+
+// 给所有线程打开计数事件，运行中没有Hook的线程也会马上进入Hook。
+// 在信号处理函数里调用，这里不用lua_sethook，它会改动行事件用的oldpc
+static void wakeup_threads(vscdbg_t *dbg) {
+    vscthread_t *th;
+    for (th = dbg->threads; th; th = th->next) {
+        lua_State *L1 = th->L;
+        th->mask |= LUA_MASKCOUNT;
+        L1->hook = dbg_hook;
+        L1->basehookcount = 1;
+        L1->hookcount = 1;
+        L1->hookmask = th->mask;
+    }
+}
+
+// 信号处理函数：正在改线程链表时不能遍历，记下来等改完再做
+static void on_wakeup_signal(int sig) {
+    vscdbg_t *dbg = wakeup_dbg;
+    if (!dbg || !has_pending(dbg)) return;
+    if (dbg->wakeupbusy)
+        dbg->wakeupdeferred = 1;
+    else
+        wakeup_threads(dbg);
+}
+
+// 改线程链表前后调用，期间收到的唤醒信号推迟到改完再处理；信号只发给被调试虚拟机的线程，
+// 和改链表的是同一个线程，所以只需要防止编译器把读写挪到标记的外面
+static inline void begin_threads_change(vscdbg_t *dbg) {
+    dbg->wakeupbusy = 1;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+}
+
+static inline void end_threads_change(vscdbg_t *dbg) {
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    dbg->wakeupbusy = 0;
+    if (dbg->wakeupdeferred) {
+        dbg->wakeupdeferred = 0;
+        if (has_pending(dbg)) wakeup_threads(dbg);
+    }
+}
+
+// 读线程收到请求，打开了唤醒信号时发信号让被调试虚拟机的线程来处理；
+// 否则请求在下一次进入Hook或宿主调用vscdbg_poll时处理
+static void on_io_notify(void *ud) {
+    vscdbg_t *dbg = ud;
+    if (dbg->wakeupsig) pthread_kill(dbg->mainthread, dbg->wakeupsig);
+}
+
+// 处理运行中收到的请求，处理完重新设置所有线程的Hook，去掉计数事件
+static void handle_pending(vscdbg_t *dbg, lua_State *L) {
+    if (lua_getglobal(dbg->dL, HANDLE_PENDING) == LUA_TFUNCTION) {
         lua_pushlightuserdata(dbg->dL, L);
-        lua_pushstring(dbg->dL, ar->source);
-        lua_pushstring(dbg->dL, ar->what);
-        lua_pushstring(dbg->dL, ar->name);
-        lua_pushinteger(dbg->dL, ar->currentline);
-        lua_pushinteger(dbg->dL, get_call_level(L));
-        check_call(dbg->dL, lua_pcall(dbg->dL, 6, 0, 0), ON_RETURN);
+        check_call(dbg->dL, lua_pcall(dbg->dL, 1, 0, 0), HANDLE_PENDING);
     } else {
-        fprintf(stderr, "%s must be a function\n", ON_RETURN);
+        fprintf(stderr, "%s must be a function\n", HANDLE_PENDING);
     }
+    vscdbg_update_hooks(dbg);
+}
+
+// 检查断点的条件和命中次数，都满足才停下来。简单的条件直接在C层求值，
+// 其他的在被调试虚拟机里编译求值，都不用进调试器脚本
+static bool check_breakpoint(lua_State *L, lua_Debug *ar, Proto *p, bpline_t *bl) {
+    int r = bl->cond ? bpcond_eval(bl->cond, L, ar, p) : BPCOND_FALLBACK;
+    if (r == BPCOND_FALSE)
+        return false;
+    if (r == BPCOND_FALLBACK && bl->condsrc && !dbgaux_checkcondition(L, ar, bl->line, bl->condsrc))
+        return false;
+    return bpline_hit(bl);
 }
 
+// 行事件：断点和单步都在这里判断，只有可能停下来时才交给调试器脚本
 static void on_line(vscdbg_t *dbg, lua_State *L, lua_Debug *ar) {
+    if (!is_stepping(dbg) && dbg->state != ST_RUNNING) return;
+    CallInfo *ci = ar->i_ci;
+    Proto *p = clLvalue(ci->func)->p;
+    int level = call_level(L, ci);
+    bool isstep = step_hit(dbg, L, level);
+    bool isbp = dbg->bptable.nlines && bptable_testproto(&dbg->bptable, p, ar->currentline);
+    if (isbp) {
+        int srcid = bptable_getproto(&dbg->bptable, p)->srcid;
+        bpline_t *bl = bptable_getline(&dbg->bptable, srcid, ar->currentline);
+        isbp = bl && check_breakpoint(L, ar, p, bl);
+        // 日志断点不停下来，消息放进缓冲
+        if (isbp && bl->logmsg) {
+            if (dbgaux_logmessage(L, ar, bl->line, bl->logmsg)) {   // <msg>
+                size_t sz;
+                const char *msg = lua_tolstring(L, -1, &sz);
+                append_log(dbg, srcid, bl->line, msg, sz);
+                lua_pop(L, 1);  // <>
+            }
+            isbp = false;
+        }
+    }
+    if (!isstep && !isbp) {
+        // 这个函数里不会再停下来，关掉行事件
+        if (!has_breakpoints(dbg, ci))
+            set_hook_mask(L, LUA_MASKCALL | LUA_MASKRET);
+        return;
+    }
+
+    vscdbg_flush_output(dbg);
     if (lua_getglobal(dbg->dL, ON_LINE) == LUA_TFUNCTION) {
-        lua_getinfo(L, "nSl", ar);
+        // 源用源ID表示，调试器脚本需要路径时再通过dbgaux.getsource取
         lua_pushlightuserdata(dbg->dL, L);
-        lua_pushstring(dbg->dL, ar->source);
-        lua_pushstring(dbg->dL, ar->what);
-        lua_pushstring(dbg->dL, ar->name);
+        lua_pushinteger(dbg->dL, bptable_getproto(&dbg->bptable, p)->srcid);
+        lua_pushstring(dbg->dL, p->linedefined == 0 ? "main" : "Lua");
         lua_pushinteger(dbg->dL, ar->currentline);
-        check_call(dbg->dL, lua_pcall(dbg->dL, 5, 0, 0), ON_LINE);
+        lua_pushboolean(dbg->dL, isbp);
+        lua_pushboolean(dbg->dL, isstep);
+        check_call(dbg->dL, lua_pcall(dbg->dL, 6, 0, 0), ON_LINE);
     } else {
         fprintf(stderr, "%s must be a function\n", ON_LINE);
     }
@@ -131,19 +501,47 @@ static void on_line(vscdbg_t *dbg, lua_State *L, lua_Debug *ar) {
 static void dbg_hook(lua_State *L, lua_Debug *ar) {
     vscdbg_t *dbg = vscdbg_get_from_state(L);
     if (dbg) {
-        if (ar->event == LUA_HOOKCALL || ar->event == LUA_HOOKTAILCALL) {
-            on_call(dbg, L, ar);
+        CallInfo *ci = ar->i_ci;
+        if (has_pending(dbg)) handle_pending(dbg, L);
+        if (ar->event == LUA_HOOKCALL) {
+            int level = call_level(L, ci);
+            set_hook_mask(L, calc_hook_mask(dbg, L, ci, level));
+        } else if (ar->event == LUA_HOOKTAILCALL) {
+            // 尾调用的函数会替换掉调用者的栈帧，层级不变
+            int level = call_level(L, ci->previous);
+            set_hook_mask(L, calc_hook_mask(dbg, L, ci, level));
         } else if (ar->event == LUA_HOOKLINE) {
             on_line(dbg, L, ar);
         } else if (ar->event == LUA_HOOKRET) {
-            on_return(dbg, L, ar);
+            // 返回后回到调用者，按调用者重新计算
+            int level = return_level(L, ci);
+            set_hook_mask(L, calc_hook_mask(dbg, L, ci->previous, level));
+        } else if (ar->event == LUA_HOOKCOUNT) {
+            // 请求已经处理过了，只需要去掉计数事件
+            set_hook_mask(L, calc_hook_mask(dbg, L, ci, call_level(L, ci)));
         }
     }
 }
 
-// 将调试器挂到一个状态机上
+// 把状态机里已经存在的线程都登记上，宿主可能在挂调试器之前就创建了协程
+static void attach_threads(vscdbg_t *dbg, lua_State *L) {
+    vscdbg_new_thread(L, L);
+    GCObject *lists[2] = {G(L)->allgc, G(L)->finobj};
+    int i;
+    for (i = 0; i < 2; ++i) {
+        GCObject *o;
+        for (o = lists[i]; o; o = o->next) {
+            if (o->tt == LUA_TTHREAD)
+                vscdbg_new_thread(L, gco2th(o));
+        }
+    }
+}
+
+// 将调试器挂到一个状态机上，被调试的状态机同时登记它所有的线程
 void vscdbg_attach_state(lua_State *L, vscdbg_t *dbg) {
     memcpy(lua_getextraspace(L), &dbg, sizeof(void*));
+    if (dbg && L == dbg->L)
+        attach_threads(dbg, L);
 }
 
 // 从状态机取调试器
@@ -151,32 +549,122 @@ vscdbg_t* vscdbg_get_from_state(lua_State *L) {
     return *((vscdbg_t**)lua_getextraspace(L));
 }
 
-// 开始Hook一个线程
+// ID哈希表：线程数量超过大小时扩大一倍
+static void idmap_insert(vscdbg_t *dbg, vscthread_t *th) {
+    if (dbg->nthreads >= dbg->idsize) {
+        int size = dbg->idsize ? dbg->idsize * 2 : 64;
+        vscthread_t **idmap = calloc(size, sizeof(vscthread_t*));
+        int i;
+        for (i = 0; i < dbg->idsize; ++i) {
+            vscthread_t *t = dbg->idmap[i];
+            while (t) {
+                vscthread_t *next = t->idnext;
+                t->idnext = idmap[t->id & (size - 1)];
+                idmap[t->id & (size - 1)] = t;
+                t = next;
+            }
+        }
+        free(dbg->idmap);
+        dbg->idmap = idmap;
+        dbg->idsize = size;
+    }
+    vscthread_t **slot = &dbg->idmap[th->id & (dbg->idsize - 1)];
+    th->idnext = *slot;
+    *slot = th;
+}
+
+static void idmap_remove(vscdbg_t *dbg, vscthread_t *th) {
+    vscthread_t **slot = &dbg->idmap[th->id & (dbg->idsize - 1)];
+    while (*slot != th)
+        slot = &(*slot)->idnext;
+    *slot = th->idnext;
+}
+
+// 按ID找被调试的线程
+vscthread_t* vscdbg_find_thread(vscdbg_t *dbg, int id) {
+    if (!dbg->idsize) return NULL;
+    vscthread_t *th = dbg->idmap[id & (dbg->idsize - 1)];
+    while (th && th->id != id)
+        th = th->idnext;
+    return th;
+}
+
+// 开始Hook一个线程，线程按创建的先后放到链表尾
 void vscdbg_new_thread(lua_State *L, lua_State *L1) {
     vscdbg_t *dbg = vscdbg_get_from_state(L);
-    if (dbg) {
-        // 表示主线程，需要设置Hook函数
-        if (L == L1) lua_sethook(L, dbg_hook, LUA_MASKCALL | LUA_MASKRET | LUA_MASKLINE, 0);
-        on_new_thread(dbg, L1);
+    // 调试器虚拟机自己的线程不需要处理
+    if (dbg && G(L1)->mainthread == dbg->L) {
+        vscthread_t *th = vscdbg_get_thread(L1);
+        th->dbg = dbg;
+        th->L = L1;
+        // 新线程继承了创建者的Hook
+        th->mask = lua_gethookmask(L1);
+        th->ci = NULL;
+        th->id = ++dbg->lastthreadid;
+        idmap_insert(dbg, th);
+        dbg->nthreads++;
+        th->next = NULL;
+        th->prev = dbg->lastthread;
+        begin_threads_change(dbg);
+        if (dbg->lastthread) dbg->lastthread->next = th;
+        else dbg->threads = th;
+        dbg->lastthread = th;
+        end_threads_change(dbg);
     }
 }
 
 // 结束Hook一个线程
 void vscdbg_free_thread(lua_State *L, lua_State *L1) {
     vscdbg_t *dbg = vscdbg_get_from_state(L);
-    if (dbg) on_free_thread(dbg, L1);
+    if (dbg && G(L1)->mainthread == dbg->L) {
+        vscthread_t *th = vscdbg_get_thread(L1);
+        begin_threads_change(dbg);
+        if (th->prev) th->prev->next = th->next;
+        else dbg->threads = th->next;
+        if (th->next) th->next->prev = th->prev;
+        else dbg->lastthread = th->prev;
+        end_threads_change(dbg);
+        idmap_remove(dbg, th);
+        dbg->nthreads--;
+        if (dbg->stepL == L1) dbg->stepL = NULL;
+    }
 }
 
-// 恢复启动一个线程
-void vscdbg_resume_thread(lua_State *L) {
-    vscdbg_t *dbg = vscdbg_get_from_state(L);
-    if (dbg) on_resume_thread(dbg, L);
+// 调试器状态或断点改变后，重新设置所有线程的Hook
+void vscdbg_update_hooks(vscdbg_t *dbg) {
+    vscthread_t *th;
+    for (th = dbg->threads; th; th = th->next) {
+        lua_State *L1 = th->L;
+        set_hook_mask(L1, calc_hook_mask(dbg, L1, L1->ci, call_level(L1, L1->ci)));
+    }
+}
+
+// 设置调试器状态，单步状态需要指定单步的线程，从该线程当前的层级开始单步
+void vscdbg_set_state(vscdbg_t *dbg, int state, lua_State *L) {
+    // 进入或离开暂停状态都让以前的变量句柄失效，放开它们引用的值
+    if ((dbg->state == ST_PAUSE) != (state == ST_PAUSE))
+        varcache_reset(&dbg->varcache, dbg->L);
+    dbg->state = state;
+    dbg->stepL = NULL;
+    dbg->steplevel = 0;
+    if (is_stepping(dbg) && L) {
+        dbg->stepL = L;
+        dbg->steplevel = call_level(L, L->ci);
+    }
+    vscdbg_update_hooks(dbg);
+}
+
+// 宿主在自己的主循环里定时调用：处理已经收到的请求，缓冲的输出由定时线程发出。
+// 被调试虚拟机不在运行Lua代码时，请求只能在这里得到处理
+void vscdbg_poll(vscdbg_t *dbg) {
+    if (has_pending(dbg)) handle_pending(dbg, dbg->L);
 }
 
 // 处理客户端请求
 void vscdbg_handle_request(vscdbg_t *dbg, lua_State *L) {
     if (lua_getglobal(dbg->dL, HANDLE_REQUEST) == LUA_TFUNCTION) {
-        check_call(dbg->dL, lua_pcall(dbg->dL, 0, 0, 0), HANDLE_REQUEST);
+        lua_pushlightuserdata(dbg->dL, L);
+        check_call(dbg->dL, lua_pcall(dbg->dL, 1, 0, 0), HANDLE_REQUEST);
     } else {
         fprintf(stderr, "%s must be a function\n", HANDLE_REQUEST);
     }
@@ -194,16 +682,33 @@ void vscdbg_debuglog(vscdbg_t *dbg, const char *fmt, ...) {
     }
 }
 
-// 输出日志
-void vscdbg_on_output(vscdbg_t *dbg, const char *str, size_t sz, const char *source, int line) {
-    if (lua_getglobal(dbg->dL, ON_OUTPUT) == LUA_TFUNCTION) {
-        lua_pushlstring(dbg->dL, str, sz);
-        lua_pushstring(dbg->dL, source);
-        lua_pushinteger(dbg->dL, line);
-        check_call(dbg->dL, lua_pcall(dbg->dL, 3, 0, 0), ON_OUTPUT);
-    } else {
-        fprintf(stderr, "%s must be a function\n", ON_OUTPUT);
+// print的输出：luaB_print每个参数和分隔符都会调一次，先放进缓冲。
+// 每行开头取一次源和行，和缓冲里的行位置不同时先把缓冲发出去，同一位置连续输出的行合并发出
+void vscdbg_on_output(vscdbg_t *dbg, lua_State *L, const char *str, size_t sz) {
+    outbuf_t *ob = &dbg->outbuf;
+    pthread_mutex_lock(&dbg->outlock);
+    // 先发出缓冲的日志，保持输出的顺序
+    if (dbg->logbuf.len) flush_log(dbg);
+    if (dbg->outlinestart || !ob->len) {
+        int srcid = 0, line = -1;
+        lua_Debug ar;
+        if (lua_getstack(L, 1, &ar) && lua_getinfo(L, "l", &ar)) {
+            line = ar.currentline;
+            if (isLua(ar.i_ci))
+                srcid = srctable_getid(&dbg->srctable, clLvalue(ar.i_ci->func)->p->source);
+        }
+        if (ob->len && (ob->srcid != srcid || ob->line != line))
+            flush_print(dbg);
+        ob->srcid = srcid;
+        ob->line = line;
+        ob->path = srcid ? srctable_getpath(&dbg->srctable, srcid, NULL) : NULL;
+        // 通知定时线程有了新的输出
+        if (!ob->len) pthread_cond_signal(&dbg->outcond);
     }
+    outbuf_append(ob, str, sz);
+    dbg->outlinestart = sz > 0 && str[sz-1] == '\n';
+    if (dbg->outlinestart) check_flush_output(dbg);
+    pthread_mutex_unlock(&dbg->outlock);
 }
 
 // 打开我自己的库
@@ -258,6 +763,22 @@ vscdbg_t* vscdbg_new(lua_State *L, const char *curpath) {
     }
 
     dbg->L = L;
+    dbg->state = ST_BIRTH;
+    srctable_init(&dbg->srctable);
+    varcache_init(&dbg->varcache);
+    outbuf_init(&dbg->logbuf);
+    outbuf_init(&dbg->outbuf);
+    outbuf_init(&dbg->jsonbuf);
+    outbuf_init(&dbg->eventbuf);
+    pthread_mutex_init(&dbg->outlock, NULL);
+    // 定时线程按单调时钟等待，和now_ms一致
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&dbg->outcond, &attr);
+    pthread_condattr_destroy(&attr);
+    capture_init(&dbg->capture);
+    bptable_init(&dbg->bptable, &dbg->srctable);
     dbg->dL = luaL_newstate();
     luaL_openlibs(dbg->dL);
     open_mylibs(dbg->dL);
@@ -267,15 +788,85 @@ vscdbg_t* vscdbg_new(lua_State *L, const char *curpath) {
     return dbg;
 }
 
+// 打开唤醒信号：记下调用线程，安装信号处理函数，原来的处理函数在vscdbg_free时恢复
+void vscdbg_enable_wakeup(vscdbg_t *dbg, int sig) {
+    dbg->mainthread = pthread_self();
+    dbg->wakeupsig = sig;
+    wakeup_dbg = dbg;
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_wakeup_signal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(sig, &sa, &dbg->oldsigaction);
+}
+
+// 通过标准输入输出与VSCode通讯，由VSCode启动调试器
+void vscdbg_open_stdio(vscdbg_t *dbg) {
+    // 通讯用stdout的副本，fd 1和2重定向到管道后，io.write、C模块的printf就不会混进协议里
+    int outfd = fcntl(fileno(stdout), F_DUPFD_CLOEXEC, 3);
+    if (outfd < 0) outfd = fileno(stdout);
+    dbg->io = vscio_new(fileno(stdin), outfd, on_io_notify, dbg);
+    start_flush_thread(dbg);
+    if (outfd != fileno(stdout) && !capture_start(&dbg->capture, dbg->io))
+        fprintf(stderr, "capture stdout and stderr failed: %s\n", strerror(errno));
+}
+
+// 在后台监听VSCode的连接，被调试程序由宿主自己运行，客户端随时可以连上来或断开
+bool vscdbg_listen(vscdbg_t *dbg, const char *addr) {
+    dbg->io = vscio_listen(addr, on_io_notify, dbg);
+    if (!dbg->io) return false;
+    start_flush_thread(dbg);
+    if (lua_getglobal(dbg->dL, ON_LISTEN) == LUA_TFUNCTION) {
+        lua_pushstring(dbg->dL, addr);
+        check_call(dbg->dL, lua_pcall(dbg->dL, 1, 0, 0), ON_LISTEN);
+    } else {
+        fprintf(stderr, "%s must be a function\n", ON_LISTEN);
+    }
+    return true;
+}
+
 // 释放DBG
 void* vscdbg_free(vscdbg_t *dbg) {
+    vscdbg_flush_output(dbg);
     if (lua_getglobal(dbg->dL, ON_STOP) == LUA_TFUNCTION) {
         check_call(dbg->dL, lua_pcall(dbg->dL, 0, 0, 0), ON_STOP);
     } else {
         fprintf(stderr, "%s must be a function\n", ON_STOP);
     }
 
+    wakeup_dbg = NULL;
+    if (dbg->hasflushthread) {
+        pthread_mutex_lock(&dbg->outlock);
+        dbg->flushquit = true;
+        pthread_cond_signal(&dbg->outcond);
+        pthread_mutex_unlock(&dbg->outlock);
+        pthread_join(dbg->flushthread, NULL);
+    }
+    capture_free(&dbg->capture);
+    if (dbg->io) vscio_free(dbg->io);
+    // 读线程已经结束，不会再发信号了
+    if (dbg->wakeupsig) sigaction(dbg->wakeupsig, &dbg->oldsigaction, NULL);
     lua_close(dbg->dL);
+    bptable_free(&dbg->bptable);
+    srctable_free(&dbg->srctable);
+    varcache_free(&dbg->varcache, dbg->L);
+    outbuf_free(&dbg->logbuf);
+    outbuf_free(&dbg->outbuf);
+    outbuf_free(&dbg->jsonbuf);
+    outbuf_free(&dbg->eventbuf);
+    pthread_mutex_destroy(&dbg->outlock);
+    pthread_cond_destroy(&dbg->outcond);
+    if (dbg->spill) fclose(dbg->spill);
+    free(dbg->spillpath);
+    // 去掉所有线程的Hook，宿主之后还可以继续运行被调试虚拟机，lua_close释放线程时也不再回调调试器
+    vscthread_t *th;
+    for (th = dbg->threads; th; th = th->next) {
+        lua_sethook(th->L, NULL, 0, 0);
+        th->dbg = NULL;
+    }
+    vscdbg_attach_state(dbg->L, NULL);
+    free(dbg->idmap);
     free(dbg);
     return NULL;
 }
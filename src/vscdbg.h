@@ -5,25 +5,137 @@
 #ifndef __VSCDBG_H__
 #define __VSCDBG_H__
 #include "defines.h"
+#include "breakpoint.h"
+#include "vscio.h"
+#include "varcache.h"
+#include "outbuf.h"
+#include "capture.h"
+#include <signal.h>
+
+// 调试器运行状态，与debugger.lua保持一致
+#define ST_BIRTH 0          // 初始状态
+#define ST_INITED 1         // 初始化完毕
+#define ST_RUNNING 2        // 运行状态
+#define ST_PAUSE 3          // 暂停状态：命中断点，或主动暂停
+#define ST_STEP_OVER 4      // 单步状态
+#define ST_STEP_IN 5        // 单步进入
+#define ST_STEP_OUT 6       // 单步跳出
+#define ST_TERMINATED 10    // 终止状态
+
+// 客户端来不及接收时print和日志断点输出的处理方式，与debugger.lua保持一致
+#define OUTPUT_BLOCK 0      // 等客户端接收，被调试的代码会被拖慢
+#define OUTPUT_DROP 1       // 丢掉，之后补一行说明丢掉了多少行
+#define OUTPUT_SPILL 2      // 转存到本地文件，之后补一行说明存到了哪里
+
+struct vscdbg;
+
+// 被调试线程的信息，保存在lua_State的额外空间里
+typedef struct vscthread {
+    struct vscdbg *dbg;         // 所属调试器，必须是第一个字段
+    struct vscthread *prev;     // 线程链表，按创建的先后排列
+    struct vscthread *next;
+    struct vscthread *idnext;   // ID哈希表的链
+    lua_State *L;               // 线程
+    struct CallInfo *ci;        // 最近一次记录层级的CallInfo
+    ptrdiff_t func;             // 该CallInfo的函数在栈上的位置，用于校验
+    int level;                  // 该CallInfo的调用层级
+    int mask;                   // 当前设置的Hook掩码
+    int id;                     // 线程ID，从1开始递增，不会重复使用，主线程为1
+} vscthread_t;
 
 typedef struct vscdbg {
     lua_State *dL;          // 调试器虚拟机
     lua_State *L;           // 被调试的虚拟机
     char curpath[512];          // 当前路径
+    int state;              // 调试器运行状态，由debugger.lua设置
+    lua_State *stepL;       // 单步的线程
+    int steplevel;          // 开始单步时的调用层级
+    srctable_t srctable;    // 源文件表
+    bptable_t bptable;      // 断点索引
+    int bpversion;          // 断点版本，断点改变时加1，用于让条件断点的缓存失效
+    varcache_t varcache;    // 暂停期间客户端展开的变量
+    struct {                // 分页取表的named成员时上一页停下的位置，下一页从这里接着找
+        lua_Integer handle; // 表的句柄，换代后自然对不上
+        int start;          // 下一页的起始序号
+        int slot;           // 下一页开始的槽位
+        const void *node;   // 表的哈希部分和数组大小，表重新分配过时槽位就不能用了
+        unsigned int sizearray;
+    } namedcursor;
+    vscthread_t *threads;   // 被调试的线程链表
+    vscthread_t *lastthread;    // 链表的尾
+    int nthreads;           // 线程数量
+    int lastthreadid;       // 最近分配的线程ID
+    vscthread_t **idmap;    // 线程ID到线程的哈希表，大小是2的幂
+    int idsize;
+    outbuf_t logbuf;        // 日志断点的输出缓冲，定时合并成一个output事件
+    outbuf_t outbuf;        // print的输出缓冲，同一位置连续输出的行合并成一个output事件
+    outbuf_t jsonbuf;       // 在C层直接编码的响应(stackTrace，variables)
+    outbuf_t eventbuf;      // 在C层编码的output事件
+    pthread_mutex_t outlock;    // 保护logbuf、outbuf、eventbuf和以下的输出策略，主线程和定时线程共用
+    pthread_cond_t outcond;     // 缓冲里有了新的输出，或定时线程要退出
+    pthread_t flushthread;      // 定时线程：到时间把缓冲的输出发出去，被调试代码阻塞在C函数里时也一样
+    bool hasflushthread;
+    bool flushquit;
+    bool outlinestart;      // 下一段print输出是不是一行的开头
+    int outpolicy;          // 写队列满了时输出的处理方式，OUTPUT_*
+    int dropped;            // 丢掉了还没报告的行数
+    int spilled;            // 转存了还没报告的行数
+    FILE *spill;            // 转存输出的文件
+    char *spillpath;
+    vscio_t *io;            // 与VSCode通讯的IO
+    capture_t capture;      // 标准输入输出模式下捕获的fd 1和2
+    int wakeupsig;          // 收到请求时唤醒被调试虚拟机的信号，0表示不用信号
+    pthread_t mainthread;   // 被调试虚拟机运行的线程，收到请求时发信号唤醒它
+    struct sigaction oldsigaction;  // 宿主原来的信号处理函数，释放时恢复
+    volatile sig_atomic_t wakeupbusy;       // 正在改线程链表，信号处理函数不能遍历
+    volatile sig_atomic_t wakeupdeferred;   // 改链表期间收到了唤醒信号
 } vscdbg_t;
 
+// 嵌入宿主程序：宿主必须链接3rd/lua下修改过的Lua，Lua里的回调由libvscdbg实现，
+// 静态链接时libvscdbg.a要放在liblua.a前面并用--start-group包起来，用法
+//   vscdbg_t *dbg = vscdbg_new(L, "<扩展目录>/bin/linux/vscluadbg");   // 用它的目录找debugger.lua
+//   vscdbg_attach_state(L, dbg);
+//   vscdbg_listen(dbg, "4711");
+//   主循环里: vscdbg_poll(dbg);
+//   退出前: vscdbg_free(dbg); lua_close(L);
+// 没有客户端连上来之前不设置任何Hook。
+// 运行中收到的请求(暂停、设断点等)在被调试虚拟机下一次进入Hook或宿主调用vscdbg_poll时处理，
+// 一直在跑不带Hook的Lua代码时，暂停要等到这段代码返回
 vscdbg_t* vscdbg_new(lua_State *L, const char *curpath);
 void* vscdbg_free(vscdbg_t *vscdbg);
+// 可选：收到请求时向调用线程发信号sig，信号处理函数给所有线程打开计数Hook，正在运行的Lua代码马上进入Hook处理请求。
+// 会替换掉进程里sig原来的处理函数(vscdbg_free时恢复)，信号还会打断调用线程上不自动重启的系统调用
+// (epoll_wait、nanosleep等返回EINTR)，所以默认不打开，宿主自己选一个不用的信号；独立运行的vscluadbg用SIGURG。
+// 要在调用线程上运行被调试虚拟机，并且在vscdbg_open_stdio或vscdbg_listen之前调用
+void vscdbg_enable_wakeup(vscdbg_t *dbg, int sig);
+void vscdbg_open_stdio(vscdbg_t *dbg);
+bool vscdbg_listen(vscdbg_t *dbg, const char *addr);
+void vscdbg_poll(vscdbg_t *dbg);
+// 监听模式下没有客户端连着：所有线程都不设Hook，print直接输出到标准输出，
+// 被调试程序和不挂调试器时一样快
+static inline bool vscdbg_is_detached(vscdbg_t *dbg) {
+    return dbg->io && dbg->io->listenfd >= 0 && !vscio_connected(dbg->io);
+}
 
 void vscdbg_attach_state(lua_State *L, vscdbg_t *dbg);
 vscdbg_t* vscdbg_get_from_state(lua_State *L);
+// 取被调试线程的信息
+static inline vscthread_t* vscdbg_get_thread(lua_State *L) {
+    return (vscthread_t*)lua_getextraspace(L);
+}
+// 按ID找被调试的线程，没有返回NULL
+vscthread_t* vscdbg_find_thread(vscdbg_t *dbg, int id);
 
 void vscdbg_new_thread(lua_State *L, lua_State *L1);
 void vscdbg_free_thread(lua_State *L, lua_State *L1);
-void vscdbg_resume_thread(lua_State *L);
+void vscdbg_update_hooks(vscdbg_t *dbg);
+void vscdbg_set_state(vscdbg_t *dbg, int state, lua_State *L);
 
 void vscdbg_handle_request(vscdbg_t *dbg, lua_State *L);
-void vscdbg_on_output(vscdbg_t *dbg, const char *str, size_t sz, const char *source, int line);
+void vscdbg_on_output(vscdbg_t *dbg, lua_State *L, const char *str, size_t sz);
 void vscdbg_debuglog(vscdbg_t *dbg, const char *fmt, ...);
+void vscdbg_flush_output(vscdbg_t *dbg);
+// 设置输出的处理方式，spillpath为NULL时转存到临时目录
+void vscdbg_set_output_policy(vscdbg_t *dbg, int policy, const char *spillpath);
 
 #endif  // __VSCDBG_H__
\ No newline at end of file
@@ -0,0 +1,594 @@
+/**
+ * 与VSCode通讯的IO
+ * by code
+ */
+#include "vscio.h"
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// 读缓冲块的大小，比它大的请求单独分配一块
+#define CHUNK_SIZE (64 * 1024)
+#define CONTENT_LENGTH "Content-Length:"
+// 一个请求的最大长度，超过了当作客户端出错，断开连接
+#define MAX_MSG_SIZE (64 * 1024 * 1024)
+// 消息头的最大长度
+#define HEADER_SIZE 64
+// 输出缓冲超过这么多就发出去
+#define OUT_FLUSH_SIZE (64 * 1024)
+// 交给写线程时，比这小的缓冲复制一份，缓冲留着复用；大的直接把缓冲交出去
+#define OUT_COPY_SIZE (16 * 1024)
+
+static vscchunk_t *new_chunk(size_t size) {
+    vscchunk_t *chunk = malloc(sizeof(vscchunk_t) + size);
+    chunk->refs = 1;
+    chunk->size = size;
+    return chunk;
+}
+
+static void release_chunk(vscchunk_t *chunk) {
+    if (chunk && __atomic_sub_fetch(&chunk->refs, 1, __ATOMIC_ACQ_REL) == 0)
+        free(chunk);
+}
+
+// 读线程被取消时释放正在读的块
+static void cleanup_chunk(void *ud) {
+    release_chunk(*(vscchunk_t**)ud);
+}
+
+static vscmsg_t *new_msg(vscchunk_t *chunk, const char *data, size_t len, int fd) {
+    vscmsg_t *msg = malloc(sizeof(vscmsg_t));
+    msg->next = NULL;
+    msg->chunk = chunk;
+    msg->data = data;
+    msg->len = len;
+    msg->fd = fd;
+    msg->closed = false;
+    if (chunk) __atomic_add_fetch(&chunk->refs, 1, __ATOMIC_RELAXED);
+    return msg;
+}
+
+static void free_msg(vscmsg_t *msg) {
+    release_chunk(msg->chunk);
+    free(msg);
+}
+
+// 唤醒等待请求的主线程
+static void wakeup(vscio_t *io) {
+    pthread_mutex_lock(&io->mutex);
+    pthread_cond_signal(&io->cond);
+    pthread_mutex_unlock(&io->mutex);
+}
+
+// 读线程：把请求放到队尾
+static void push_msg(vscio_t *io, vscmsg_t *msg) {
+    __atomic_store_n(&io->tail->next, msg, __ATOMIC_RELEASE);
+    io->tail = msg;
+    __atomic_add_fetch(&io->pending, 1, __ATOMIC_RELEASE);
+    wakeup(io);
+    if (io->notify) io->notify(io->ud);
+}
+
+// 找消息头的结尾，返回内容开始的位置，没找到返回NULL
+static const char *find_header_end(const char *s, const char *e) {
+    for (; s + 4 <= e; ++s) {
+        if (s[0] == '\r' && s[1] == '\n' && s[2] == '\r' && s[3] == '\n')
+            return s + 4;
+    }
+    return NULL;
+}
+
+// 从消息头里取Content-Length，没有返回-1，超过MAX_MSG_SIZE返回-2
+static long parse_length(const char *s, const char *e) {
+    size_t n = strlen(CONTENT_LENGTH);
+    for (; s + n <= e; ++s) {
+        if (memcmp(s, CONTENT_LENGTH, n) == 0) {
+            long len = 0;
+            for (s += n; s < e && *s == ' '; ++s);
+            for (; s < e && *s >= '0' && *s <= '9'; ++s) {
+                len = len * 10 + (*s - '0');
+                if (len > MAX_MSG_SIZE) return -2;
+            }
+            return len;
+        }
+    }
+    return -1;
+}
+
+// 读线程：读一个会话的请求直到客户端断开，请求直接读进大块的缓冲，
+// 完整的请求引用缓冲里的数据放进队列，不复制；块用完后，剩下不完整的请求搬到新块里接着读
+static void read_session(vscio_t *io, int infd, int outfd) {
+    vscchunk_t *chunk = new_chunk(CHUNK_SIZE);
+    size_t start = 0, end = 0;     // 未处理的数据
+    size_t need = 0;               // 下一个请求至少需要的数据量
+    size_t scanned = 0;            // start后面已经找过消息头结尾的长度，下次从这里接着找
+    pthread_cleanup_push(cleanup_chunk, &chunk);
+    for (;;) {
+        // 切出所有完整的请求
+        while (end > start) {
+            const char *s = chunk->data + start, *e = chunk->data + end;
+            const char *body = find_header_end(s + scanned, e);
+            if (!body) {
+                need = end - start + 1;
+                // 结尾的\r\n\r\n可能被读断开，留3个字节下次再找
+                scanned = end - start > 3 ? end - start - 3 : 0;
+                break;
+            }
+            scanned = 0;
+            long len = parse_length(s, body);
+            if (len == -2) {
+                need = SIZE_MAX;
+                break;
+            }
+            if (len < 0) {
+                // 不认识的消息头，跳过
+                start = body - chunk->data;
+                continue;
+            }
+            if (e - body < len) {
+                need = body - s + len;
+                break;
+            }
+            push_msg(io, new_msg(chunk, body, len, outfd));
+            start = body - chunk->data + len;
+        }
+        // 太长的请求或一直没有结尾的消息头，不再读这个会话
+        if (need > MAX_MSG_SIZE + CHUNK_SIZE)
+            break;
+        if (start == end) {
+            // 块里的请求都已经取走了才能从头复用
+            need = 0;
+            if (__atomic_load_n(&chunk->refs, __ATOMIC_ACQUIRE) == 1)
+                start = end = 0;
+        }
+        // 块里放不下下一个请求，换一个新块
+        if (start + need > chunk->size || end == chunk->size) {
+            size_t size = CHUNK_SIZE;
+            while (size < need) size *= 2;
+            vscchunk_t *nchunk = new_chunk(size);
+            memcpy(nchunk->data, chunk->data + start, end - start);
+            end -= start;
+            start = 0;
+            release_chunk(chunk);
+            chunk = nchunk;
+        }
+        ssize_t n = read(infd, chunk->data + end, chunk->size - end);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        end += n;
+    }
+    pthread_cleanup_pop(1);
+    // 会话结束，连接由主线程取到结束标记时关闭
+    vscmsg_t *msg = new_msg(NULL, NULL, 0, outfd);
+    msg->closed = true;
+    push_msg(io, msg);
+}
+
+static void *read_thread(void *ud) {
+    vscio_t *io = ud;
+    read_session(io, io->infd, io->stdoutfd);
+    __atomic_store_n(&io->closed, 1, __ATOMIC_RELEASE);
+    wakeup(io);
+    return NULL;
+}
+
+// 监听线程：一次只服务一个客户端，断开后再接受下一个
+static void *listen_thread(void *ud) {
+    vscio_t *io = ud;
+    for (;;) {
+        int fd = accept(io->listenfd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            break;
+        }
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+#ifdef SO_NOSIGPIPE
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+        __atomic_store_n(&io->connfd, fd, __ATOMIC_RELEASE);
+        read_session(io, fd, fd);
+        __atomic_store_n(&io->connfd, -1, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&io->closed, 1, __ATOMIC_RELEASE);
+    wakeup(io);
+    return NULL;
+}
+
+// 把iov全部写到fd，处理写了一部分的情况；socket用sendmsg，客户端断开时不会收到SIGPIPE
+static void write_iov(vscio_t *io, int fd, struct iovec *iov, int n) {
+    while (n > 0) {
+        ssize_t sz;
+        if (io->listenfd >= 0) {
+            struct msghdr mh;
+            memset(&mh, 0, sizeof(mh));
+            mh.msg_iov = iov;
+            mh.msg_iovlen = n;
+#ifdef MSG_NOSIGNAL
+            sz = sendmsg(fd, &mh, MSG_NOSIGNAL);
+#else
+            sz = sendmsg(fd, &mh, 0);
+#endif
+        } else {
+            sz = writev(fd, iov, n);
+        }
+        if (sz < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        while (n > 0 && (size_t)sz >= iov->iov_len) {
+            sz -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0) {
+            iov->iov_base = (char*)iov->iov_base + sz;
+            iov->iov_len -= sz;
+        }
+    }
+}
+
+static void free_wblock(vscwblock_t *b) {
+    if (b->data != (char*)(b + 1)) free(b->data);
+    free(b);
+}
+
+// 写线程：按顺序把写队列里的块写出去，客户端接收得慢时只有这个线程阻塞
+static void *write_thread(void *ud) {
+    vscio_t *io = ud;
+    pthread_mutex_lock(&io->wmutex);
+    for (;;) {
+        while (!io->whead && !io->wquit)
+            pthread_cond_wait(&io->wcond, &io->wmutex);
+        vscwblock_t *b = io->whead;
+        // 退出前先把队列写完
+        if (!b) break;
+        io->whead = b->next;
+        if (!io->whead) io->wtail = NULL;
+        io->wfd = b->fd;
+        pthread_mutex_unlock(&io->wmutex);
+
+        struct iovec iov;
+        iov.iov_base = b->data;
+        iov.iov_len = b->len;
+        write_iov(io, b->fd, &iov, 1);
+
+        pthread_mutex_lock(&io->wmutex);
+        __atomic_sub_fetch(&io->wbytes, b->len, __ATOMIC_RELEASE);
+        io->wfd = -1;
+        free_wblock(b);
+        pthread_cond_broadcast(&io->wcond);
+    }
+    pthread_mutex_unlock(&io->wmutex);
+    return NULL;
+}
+
+static void start_write_thread(vscio_t *io) {
+    if (pthread_create(&io->wthread, NULL, write_thread, io) == 0)
+        io->haswthread = true;
+    else
+        fprintf(stderr, "vscio: create write thread failed, write directly\n");
+}
+
+// 等写线程把队列写完后退出
+static void stop_write_thread(vscio_t *io) {
+    if (!io->haswthread) return;
+    pthread_mutex_lock(&io->wmutex);
+    io->wquit = true;
+    pthread_cond_broadcast(&io->wcond);
+    pthread_mutex_unlock(&io->wmutex);
+    pthread_join(io->wthread, NULL);
+    io->haswthread = false;
+}
+
+// 会话结束，丢掉还没写到fd的块，等写线程写完正在写的块，之后才能关闭fd
+static void cancel_writes(vscio_t *io, int fd) {
+    pthread_mutex_lock(&io->wmutex);
+    vscwblock_t **pb = &io->whead;
+    io->wtail = NULL;
+    while (*pb) {
+        vscwblock_t *b = *pb;
+        if (b->fd == fd) {
+            *pb = b->next;
+            __atomic_sub_fetch(&io->wbytes, b->len, __ATOMIC_RELEASE);
+            free_wblock(b);
+        } else {
+            io->wtail = b;
+            pb = &b->next;
+        }
+    }
+    while (io->wfd == fd)
+        pthread_cond_wait(&io->wcond, &io->wmutex);
+    pthread_mutex_unlock(&io->wmutex);
+}
+
+static vscio_t *create_io(vscio_notify_t notify, void *ud) {
+    vscio_t *io = malloc(sizeof(vscio_t));
+    memset(io, 0, sizeof(vscio_t));
+    io->infd = io->stdoutfd = io->listenfd = io->connfd = io->outfd = -1;
+    io->head = io->tail = new_msg(NULL, NULL, 0, -1);
+    io->notify = notify;
+    io->ud = ud;
+    pthread_mutex_init(&io->mutex, NULL);
+    pthread_cond_init(&io->cond, NULL);
+    pthread_mutex_init(&io->wmutex, NULL);
+    pthread_cond_init(&io->wcond, NULL);
+    io->wlimit = VSCIO_WLIMIT;
+    io->wfd = -1;
+    start_write_thread(io);
+    return io;
+}
+
+static void start_thread(vscio_t *io, void *(*func)(void*)) {
+    if (pthread_create(&io->thread, NULL, func, io) != 0) {
+        fprintf(stderr, "vscio: create read thread failed\n");
+        io->closed = 1;
+        io->thread = pthread_self();
+    }
+}
+
+vscio_t *vscio_new(int infd, int outfd, vscio_notify_t notify, void *ud) {
+    vscio_t *io = create_io(notify, ud);
+    io->infd = infd;
+    io->stdoutfd = io->outfd = outfd;
+    start_thread(io, read_thread);
+    return io;
+}
+
+// 打开监听的socket，失败返回-1
+static int open_listener(const char *addr, char **unixpath) {
+    int fd;
+    if (strncmp(addr, "unix:", 5) == 0) {
+        const char *path = addr + 5;
+        struct sockaddr_un sa;
+        memset(&sa, 0, sizeof(sa));
+        if (strlen(path) >= sizeof(sa.sun_path)) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        sa.sun_family = AF_UNIX;
+        strcpy(sa.sun_path, path);
+        if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+            return -1;
+        // 上次没有删掉的socket文件
+        unlink(path);
+        if (bind(fd, (struct sockaddr*)&sa, sizeof(sa)) < 0 || listen(fd, 1) < 0) {
+            close(fd);
+            return -1;
+        }
+        *unixpath = strdup(path);
+    } else {
+        // 默认只监听本机
+        char host[64] = "127.0.0.1";
+        const char *port = strrchr(addr, ':');
+        if (port) {
+            size_t n = port - addr;
+            if (n >= sizeof(host)) {
+                errno = EINVAL;
+                return -1;
+            }
+            if (n > 0) {
+                memcpy(host, addr, n);
+                host[n] = '\0';
+            }
+            port++;
+        } else {
+            port = addr;
+        }
+        struct sockaddr_in sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sin_family = AF_INET;
+        sa.sin_port = htons(atoi(port));
+        if (inet_pton(AF_INET, host, &sa.sin_addr) != 1) {
+            errno = EINVAL;
+            return -1;
+        }
+        if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+            return -1;
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (bind(fd, (struct sockaddr*)&sa, sizeof(sa)) < 0 || listen(fd, 1) < 0) {
+            close(fd);
+            return -1;
+        }
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+}
+
+vscio_t *vscio_listen(const char *addr, vscio_notify_t notify, void *ud) {
+    char *unixpath = NULL;
+    int fd = open_listener(addr, &unixpath);
+    if (fd < 0) return NULL;
+    vscio_t *io = create_io(notify, ud);
+    io->listenfd = fd;
+    io->unixpath = unixpath;
+    start_thread(io, listen_thread);
+    return io;
+}
+
+void vscio_free(vscio_t *io) {
+    vscio_flush(io);
+    stop_write_thread(io);
+    if (!pthread_equal(io->thread, pthread_self())) {
+        // 读线程可能还阻塞在输入上
+        if (!__atomic_load_n(&io->closed, __ATOMIC_ACQUIRE))
+            pthread_cancel(io->thread);
+        pthread_join(io->thread, NULL);
+    }
+    vscmsg_t *msg = io->head;
+    while (msg) {
+        vscmsg_t *next = msg->next;
+        // 还没取走的结束标记，连接还没关闭
+        if (msg->closed && io->listenfd >= 0 && msg != io->head) close(msg->fd);
+        free_msg(msg);
+        msg = next;
+    }
+    if (io->listenfd >= 0) {
+        if (io->connfd >= 0) close(io->connfd);
+        close(io->listenfd);
+        if (io->unixpath) unlink(io->unixpath);
+    }
+    free(io->unixpath);
+    pthread_mutex_destroy(&io->mutex);
+    pthread_cond_destroy(&io->cond);
+    pthread_mutex_destroy(&io->wmutex);
+    pthread_cond_destroy(&io->wcond);
+    free(io->outbuf);
+    free(io);
+}
+
+int vscio_recv(vscio_t *io, bool block, const char **data, size_t *len) {
+    vscio_flush(io);
+    vscmsg_t *next = __atomic_load_n(&io->head->next, __ATOMIC_ACQUIRE);
+    if (!next && block) {
+        pthread_mutex_lock(&io->mutex);
+        while (!(next = __atomic_load_n(&io->head->next, __ATOMIC_ACQUIRE)) &&
+                !__atomic_load_n(&io->closed, __ATOMIC_ACQUIRE))
+            pthread_cond_wait(&io->cond, &io->mutex);
+        pthread_mutex_unlock(&io->mutex);
+    }
+    if (!next)
+        return __atomic_load_n(&io->closed, __ATOMIC_ACQUIRE) ? VSCIO_CLOSED : VSCIO_NONE;
+    // 取走的节点成为新的队列头，它的内容在下一次取请求前都有效
+    free_msg(io->head);
+    io->head = next;
+    __atomic_sub_fetch(&io->pending, 1, __ATOMIC_RELEASE);
+    if (next->fd != io->outfd) {
+        // 新的客户端，之前缓冲的消息不再有人接收
+        __atomic_store_n(&io->outfd, next->fd, __ATOMIC_RELEASE);
+        io->outlen = 0;
+    }
+    if (next->closed) {
+        // 先让其他线程不再往这个会话发消息，再取消它的写
+        __atomic_store_n(&io->outfd, -1, __ATOMIC_RELEASE);
+        io->outlen = 0;
+        if (io->listenfd >= 0) {
+            cancel_writes(io, next->fd);
+            close(next->fd);
+        }
+        return VSCIO_CLOSED;
+    }
+    *data = next->data;
+    *len = next->len;
+    return VSCIO_MSG;
+}
+
+static void append_out(vscio_t *io, const char *data, size_t len) {
+    if (io->outlen + len > io->outcap) {
+        size_t cap = io->outcap ? io->outcap : OUT_FLUSH_SIZE;
+        while (cap < io->outlen + len) cap *= 2;
+        io->outbuf = realloc(io->outbuf, cap);
+        io->outcap = cap;
+    }
+    memcpy(io->outbuf + io->outlen, data, len);
+    io->outlen += len;
+}
+
+// 把一块放进写队列
+static void push_wblock(vscio_t *io, vscwblock_t *b) {
+    pthread_mutex_lock(&io->wmutex);
+    // 队列满了等写线程写出去一些，没满时这一块都放得进去，队列最多超出上限一块
+    while (io->wbytes >= io->wlimit)
+        pthread_cond_wait(&io->wcond, &io->wmutex);
+    // 其他线程发的块在锁里才定下发给哪个会话：主线程先把outfd设为-1再取消会话的写，
+    // 这里要么看到-1丢掉，要么放进去的块会被取消掉，不会写到关掉后被复用的fd上
+    if (b->fd < 0) {
+        b->fd = __atomic_load_n(&io->outfd, __ATOMIC_ACQUIRE);
+        if (b->fd < 0) {
+            pthread_mutex_unlock(&io->wmutex);
+            free_wblock(b);
+            return;
+        }
+    }
+    if (io->wtail) io->wtail->next = b;
+    else io->whead = b;
+    io->wtail = b;
+    __atomic_add_fetch(&io->wbytes, b->len, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&io->wcond);
+    pthread_mutex_unlock(&io->wmutex);
+}
+
+void vscio_send(vscio_t *io, const char *body, size_t len) {
+    if (io->outfd < 0) return;
+    char header[HEADER_SIZE];
+    int hlen = snprintf(header, sizeof(header), "Content-Length: %zu\r\n\r\n", len);
+    append_out(io, header, hlen);
+    append_out(io, body, len);
+    if (io->outlen >= OUT_FLUSH_SIZE)
+        vscio_flush(io);
+}
+
+void vscio_sendframe(vscio_t *io, const char *frame, size_t len) {
+    if (io->outfd < 0) return;
+    append_out(io, frame, len);
+    if (io->outlen >= OUT_FLUSH_SIZE)
+        vscio_flush(io);
+}
+
+void vscio_flush(vscio_t *io) {
+    if (!io->outlen) return;
+    if (io->outfd < 0 || !io->haswthread) {
+        struct iovec iov;
+        iov.iov_base = io->outbuf;
+        iov.iov_len = io->outlen;
+        if (io->outfd >= 0) write_iov(io, io->outfd, &iov, 1);
+        io->outlen = 0;
+        return;
+    }
+    vscwblock_t *b;
+    if (io->outlen < OUT_COPY_SIZE) {
+        b = malloc(sizeof(vscwblock_t) + io->outlen);
+        b->data = (char*)(b + 1);
+        memcpy(b->data, io->outbuf, io->outlen);
+    } else {
+        b = malloc(sizeof(vscwblock_t));
+        b->data = io->outbuf;
+        io->outbuf = NULL;
+        io->outcap = 0;
+    }
+    b->next = NULL;
+    b->fd = io->outfd;
+    b->len = io->outlen;
+    io->outlen = 0;
+    push_wblock(io, b);
+}
+
+void vscio_post(vscio_t *io, const char *body, size_t len) {
+    char header[HEADER_SIZE];
+    int hlen = snprintf(header, sizeof(header), "Content-Length: %zu\r\n\r\n", len);
+    if (!io->haswthread) {
+        int fd = __atomic_load_n(&io->outfd, __ATOMIC_ACQUIRE);
+        if (fd < 0) return;
+        struct iovec iov[2];
+        iov[0].iov_base = header;
+        iov[0].iov_len = hlen;
+        iov[1].iov_base = (void*)body;
+        iov[1].iov_len = len;
+        write_iov(io, fd, iov, 2);
+        return;
+    }
+    vscwblock_t *b = malloc(sizeof(vscwblock_t) + hlen + len);
+    b->next = NULL;
+    b->fd = -1;     // 放进队列时取当前的会话
+    b->data = (char*)(b + 1);
+    b->len = hlen + len;
+    memcpy(b->data, header, hlen);
+    memcpy(b->data + hlen, body, len);
+    push_wblock(io, b);
+}
+
+
+void vscio_drain(vscio_t *io) {
+    vscio_flush(io);
+    pthread_mutex_lock(&io->wmutex);
+    while (io->haswthread && io->wbytes > 0)
+        pthread_cond_wait(&io->wcond, &io->wmutex);
+    pthread_mutex_unlock(&io->wmutex);
+}
@@ -0,0 +1,126 @@
+/**
+ * 与VSCode通讯的IO：后台线程读取请求，按Content-Length分帧后放进无锁队列，
+ * 主线程不需要阻塞在输入上，运行中也能及时发现有新的请求；
+ * 发出的消息先放进输出缓冲，一批消息合并成一块交给写线程，写队列有上限，
+ * 客户端接收得慢时主线程不会阻塞在写上，队列满了才等待。
+ * 可以用标准输入输出通讯，也可以监听一个socket，客户端断开后等待下一个客户端连接
+ * by code
+ */
+#ifndef __VSCIO_H__
+#define __VSCIO_H__
+#include "defines.h"
+#include <pthread.h>
+
+// 读缓冲块，请求的内容直接引用块里的数据，所有引用都释放后才释放块
+typedef struct vscchunk {
+    int refs;                   // 引用计数，原子操作
+    size_t size;                // 块的大小
+    char data[1];
+} vscchunk_t;
+
+// 一个请求，队列的节点
+typedef struct vscmsg {
+    struct vscmsg *next;
+    vscchunk_t *chunk;          // 内容所在的读缓冲块
+    const char *data;           // 请求内容，不以\0结尾
+    size_t len;                 // 请求内容的长度
+    int fd;                     // 请求所在会话的输出
+    bool closed;                // 会话结束的标记，没有内容
+} vscmsg_t;
+
+// 取请求的结果
+#define VSCIO_NONE 0            // 没有请求
+#define VSCIO_MSG 1             // 取到一个请求
+#define VSCIO_CLOSED 2          // 客户端断开了
+
+// 写队列的一块，一次flush的所有消息
+typedef struct vscwblock {
+    struct vscwblock *next;
+    int fd;                     // 写到哪个会话
+    char *data;                 // 直接接管主线程的输出缓冲，不复制
+    size_t len;
+} vscwblock_t;
+
+// 写队列默认的上限
+#define VSCIO_WLIMIT (4 * 1024 * 1024)
+
+// 读线程收到请求后的通知，在读线程里调用
+typedef void (*vscio_notify_t)(void *ud);
+
+// 单生产者单消费者的无锁队列：读线程只动tail，主线程只动head
+typedef struct vscio {
+    int infd;                   // 标准输入输出模式下请求的输入
+    int stdoutfd;               // 标准输入输出模式下消息的输出
+    int listenfd;               // 监听的socket，-1表示用标准输入输出
+    char *unixpath;             // 监听的unix socket路径，释放时删除
+    int connfd;                 // 当前连接的socket，读线程设置，原子操作
+    int outfd;                  // 当前会话的输出，-1表示没有客户端，主线程设置，其他线程发消息时原子地读
+    pthread_t thread;           // 读线程
+    vscmsg_t *head;             // 队列头，总是一个已经取走的节点，主线程独占
+    vscmsg_t *tail;             // 队列尾，读线程独占
+    int pending;                // 未取走的请求数量，原子操作
+    int closed;                 // 输入是否已经结束，原子操作
+    pthread_mutex_t mutex;      // 以下两项用于主线程阻塞等待请求
+    pthread_cond_t cond;
+    vscio_notify_t notify;
+    void *ud;
+    char *outbuf;               // 输出缓冲，只在主线程使用
+    size_t outlen;
+    size_t outcap;
+    pthread_t wthread;          // 写线程
+    bool haswthread;
+    pthread_mutex_t wmutex;     // 保护以下各项
+    pthread_cond_t wcond;       // 写队列有了新块，或写完了一块
+    vscwblock_t *whead;         // 写队列
+    vscwblock_t *wtail;
+    size_t wbytes;              // 队列里还没写完的字节数，包括正在写的块，原子操作
+    size_t wlimit;              // 队列的上限
+    int wfd;                    // 写线程正在写的会话，-1表示空闲
+    bool wquit;                 // 让写线程退出
+    long long seq;              // 最近分配的消息序号，原子操作，主线程和捕获输出的线程共用
+} vscio_t;
+
+// 新建IO并启动读线程，通过infd读取请求，通过outfd发送消息
+vscio_t *vscio_new(int infd, int outfd, vscio_notify_t notify, void *ud);
+// 新建IO并在后台监听客户端连接，addr可以是"unix:路径"，或"[127.0.0.1:]端口"，
+// 失败返回NULL，错误信息在errno
+vscio_t *vscio_listen(const char *addr, vscio_notify_t notify, void *ud);
+void vscio_free(vscio_t *io);
+
+// 是否有未取走的请求，开销很小，可以在Hook里调用
+static inline bool vscio_pending(vscio_t *io) {
+    return __atomic_load_n(&io->pending, __ATOMIC_ACQUIRE) > 0;
+}
+// 取一个请求，返回VSCIO_*，请求的内容在下一次调用前有效；没有请求时block为true则等到有请求。
+// 客户端断开时返回一次VSCIO_CLOSED，标准输入输出模式下之后总是返回VSCIO_CLOSED。
+// 取之前先发出缓冲的消息
+int vscio_recv(vscio_t *io, bool block, const char **data, size_t *len);
+// 是否有客户端连接着
+static inline bool vscio_connected(vscio_t *io) {
+    return io->outfd >= 0;
+}
+
+// 发送一个消息，没有客户端时丢掉，加上Content-Length头后放进输出缓冲
+void vscio_send(vscio_t *io, const char *body, size_t len);
+// 发送一个已经带了Content-Length头的完整消息，没有客户端时丢掉
+void vscio_sendframe(vscio_t *io, const char *frame, size_t len);
+// 把缓冲的消息交给写线程，写队列满了时等到有空间
+void vscio_flush(vscio_t *io);
+// 发送一个消息，不经过输出缓冲直接放进写队列，发给主线程当前的会话，没有客户端时丢掉；可以在其他线程调用
+void vscio_post(vscio_t *io, const char *body, size_t len);
+// 把缓冲的消息交给写线程，并等到全部写出去，用于进程退出前
+void vscio_drain(vscio_t *io);
+// 写队列是不是满了，满了再发消息会阻塞，调用者可以选择丢掉不重要的消息
+static inline bool vscio_full(vscio_t *io) {
+    return __atomic_load_n(&io->wbytes, __ATOMIC_ACQUIRE) + io->outlen >= io->wlimit;
+}
+// 分配一个消息序号，任何线程都可以调用，序号唯一且递增
+static inline long long vscio_next_seq(vscio_t *io) {
+    return __atomic_add_fetch(&io->seq, 1, __ATOMIC_RELAXED);
+}
+// 同上，但不算主线程的输出缓冲，其他线程用它决定vscio_post会不会阻塞
+static inline bool vscio_wfull(vscio_t *io) {
+    return __atomic_load_n(&io->wbytes, __ATOMIC_ACQUIRE) >= io->wlimit;
+}
+
+#endif // __VSCIO_H__
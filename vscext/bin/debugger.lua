@@ -19,27 +19,61 @@ local ST_STEP_IN = 5    -- 单步进入
 local ST_STEP_OUT = 6   -- 单步跳出
 local ST_TERMINATED = 10 -- 终止状态 
 
-local THREAD_ID = 1     -- 线程ID
+local THREADS_PAGE = 1000   -- threads请求默认最多返回的线程数
 
 -- 调试器
 debugger = {
     state = ST_BIRTH,   -- 状态
     currco = nil,        -- 当前的协程信息
-    coinfos = {},       -- 协程信息
+    coinfos = setmetatable({}, {__mode = "k"}),  -- 协程信息，以协程为键，用到时才登记
+    ncoinfos = 0,       -- coinfos里的数量，超过上限时去掉已经释放的协程
+    maxcoinfos = 64,    -- coinfos的上限
     nodebug = false,    -- 不调试
-    breakpoints = {},   -- 断点列表
+    breakpoints = {},   -- 断点列表，以源ID为键
     isattach = false,   -- 是否attach状态
+    islisten = false,   -- 是否监听模式：脚本由宿主运行，客户端随时可以连上来或断开
     pausereason = nil,   -- 暂停原因
+    frames = {},        -- 栈帧ID对应的{co=协程, level=层级}，继续运行后失效
+    lastframe = 0,      -- 最近分配的栈帧ID
 
     log = nil,          -- 测试代码
-    obuffer = "",       -- 输出的缓冲
-    osource = nil,      -- 输出的代码
-    oline = nil,        -- 输出的行
 }
 
 -----------------------------------------------------------------------------------
 -- 辅助函数
 
+-- 设置调试器状态，同时同步给C层的Hook，单步状态需要指定单步的协程；
+-- 状态改变后之前的栈帧都不再有效
+local function set_state(state, co)
+    debugger.state = state
+    debugger.frames = {}
+    debugger.lastframe = 0
+    dbgaux.setdbgstate(state, co)
+end
+
+-- 给协程co第level层的栈帧分配一个ID
+local function new_frame(co, level)
+    debugger.lastframe = debugger.lastframe + 1
+    debugger.frames[debugger.lastframe] = {co = co, level = level}
+    return debugger.lastframe
+end
+
+-- 变量引用：栈帧的参数、局部变量、上值分别是类型1、2、3，和栈帧ID一起编码；
+-- 类型0是dbgaux分配的表的句柄，暂停期间一直有效
+local function encode_varref(type, frameId)
+    return frameId * 4 + type
+end
+
+local function decode_varref(ref)
+    return ref % 4, ref // 4
+end
+
+-- 请求里指定的线程，没有指定时用当前的协程
+local function get_req_thread(coinfo, req)
+    local id = req.arguments and req.arguments.threadId
+    return id and dbgaux.getthread(id) or (coinfo and coinfo.co)
+end
+
 -- 取函数名
 local function get_funcname(source, what, name)
     if what == 'Lua' then
@@ -50,67 +84,69 @@ local function get_funcname(source, what, name)
     return '[unknown]'
 end
 
+-- 取源ID对应的路径，不是文件的源返回nil
+local source_paths = {}
+local function get_source(srcid)
+    local path = source_paths[srcid]
+    if path == nil then
+        path = dbgaux.getsource(srcid) or false
+        source_paths[srcid] = path
+    end
+    return path or nil
+end
+
 -- 过滤掉不能调试的代码，C代码，动态加载的代码
 local lua_file_map = {}
-local function check_call_filter(source, what)
+local function check_call_filter(srcid, what)
     if debugger.nodebug then
         return false
     end
     if what == "Lua" then
         return true
     elseif what == "main" then
-        source = straux.startswith(source, "@") and source:sub(2) or source
-        local e = lua_file_map[source]
+        local e = lua_file_map[srcid]
         if e == nil then
-            e = not not pathaux.exists(source)
-            lua_file_map[source] = e
+            local path = get_source(srcid)
+            e = path and not not pathaux.exists(path) or false
+            lua_file_map[srcid] = e
         end
         return e
     end
     return false
 end
 
-local function check_condition(coinfo, cond)
-    if not cond or cond == "" then
-        return true
-    end
-    local ok, res = dbgaux.evaluate(coinfo.co, cond, 0)
-    if not ok then
-        return true
+-- 取协程信息：C层不再通知协程的创建和释放，停在某个协程里或处理请求时才登记
+local function get_coinfo(co)
+    local coinfo = debugger.coinfos[co]
+    if not coinfo then
+        coinfo = {
+            co = co,        -- 协程
+            pco = nil,      -- 前一个协程
+        }
+        debugger.coinfos[co] = coinfo
+        -- 协程是lightuserdata，弱键不会回收它，释放了的协程由C层的线程链表判断
+        debugger.ncoinfos = debugger.ncoinfos + 1
+        if debugger.ncoinfos > debugger.maxcoinfos then
+            debugger.ncoinfos = dbgaux.prunethreads(debugger.coinfos)
+            debugger.maxcoinfos = math.max(64, debugger.ncoinfos * 2)
+        end
     end
-    return res ~= "false" and res ~= "nil"
-end
-
--- 检查断点是否命中
-local function breakpoints_hittest(coinfo, source, line)
-    source = straux.startswith(source, "@") and source:sub(2) or source
-    local bps = debugger.breakpoints[source]
-    if bps then
-        for _, bp in ipairs(bps) do
-            if bp.line == line then
-                -- 检查条件
-                if check_condition(coinfo, bp.condition) then
-                    -- 检查忽略命中次数
-                    bp.currHitCount = bp.currHitCount + 1
-                    if bp.currHitCount > bp.hitCount then
-                        bp.currHitCount = 0
-                        -- 日志断点
-                        if bp.logMessage then
-                            vscaux.send_event("output", {
-                                category = "console",
-                                output = bp.logMessage,
-                                source = {path = source},
-                                line = line,
-                            })
-                            return false
-                        end
-                        return true
-                    end
-                end
-            end
+    return coinfo
+end
+
+-- 客户端断开：去掉所有断点，让被调试程序继续运行，C层的Hook也会全部去掉
+local function detach()
+    for srcid in pairs(debugger.breakpoints) do
+        local path = get_source(srcid)
+        if path then
+            dbgaux.setbreakpoints(path, {})
         end
     end
-    return false
+    debugger.breakpoints = {}
+    debugger.isattach = false
+    debugger.pausereason = nil
+    debugger.currco = nil
+    set_state(ST_RUNNING)
 end
 
 -----------------------------------------------------------------------------
@@ -119,7 +155,7 @@ local reqfuncs = {}
 local seq = 1
 
 function reqfuncs.initialize(coinfo, req)
-    debugger.state = ST_INITED
+    set_state(ST_INITED)
     -- 回应初始化
     vscaux.send_response(req.command, req.seq, {
         supportsConfigurationDoneRequest = true,
@@ -136,18 +172,6 @@ function reqfuncs.initialize(coinfo, req)
     })
 end
 
-local function calc_hitcount(hitexpr)
-    if not hitexpr then return 0 end
-    
-    local f, msg = load("return " .. hitexpr, "=hitexpr")
-    if not f then return 0 end
-    
-    local ok, ret = pcall(f)
-    if not ok then return 0 end
-    
-    return tonumber(ret) or 0
-end
-
 function reqfuncs.setBreakpoints(coinfo, req)
     -- 保存断点 和回应断点
     args = req.arguments
@@ -160,8 +184,7 @@ function reqfuncs.setBreakpoints(coinfo, req)
             line = bp.line,
             logMessage = bp.logMessage,
             condition = bp.condition,
-            hitCount = calc_hitcount(bp.hitCondition),
-            currHitCount = 0,
+            hitCondition = bp.hitCondition,
         }
         bps[#bps+1] = {
             verified = true,
@@ -169,7 +192,8 @@ function reqfuncs.setBreakpoints(coinfo, req)
             line = bp.line,
         }
     end
-    debugger.breakpoints[src] = bpinfos
+    local srcid = dbgaux.setbreakpoints(src, bpinfos)
+    debugger.breakpoints[srcid] = bpinfos
     vscaux.send_response(req.command, req.seq, {
         breakpoints = bps,
     })
@@ -183,9 +207,24 @@ function reqfuncs.configurationDone(coinfo, req)
     vscaux.send_response(req.command, req.seq)
 end
 
+-- 客户端来不及接收输出时的处理方式：block等待，drop丢掉，spill转存到文件
+local function set_output_policy(args)
+    local policy = args.outputPolicy
+    if policy ~= "drop" and policy ~= "spill" then
+        policy = "block"
+    end
+    local path = args.outputSpillFile
+    dbgaux.setoutputpolicy(policy, type(path) == "string" and path or nil)
+end
+
 function reqfuncs.launch(coinfo, req)
+    if debugger.islisten then
+        vscaux.send_error_response(req.command, req.seq, "Launch failed: program is already running, use attach")
+        return
+    end
     -- noDebug
     debugger.nodebug = req.arguments.noDebug
+    set_output_policy(req.arguments)
     -- 设置lua path
     local luapath = req.arguments.luaPath
     if type(luapath) ~= 'string' then
@@ -229,7 +268,7 @@ function reqfuncs.launch(coinfo, req)
     vscaux.send_response(req.command, req.seq)
     -- 运行脚本
     debugger.isattach = false
-    debugger.state = req.arguments.stopOnEntry and ST_STEP_IN or ST_RUNNING
+    set_state(req.arguments.stopOnEntry and ST_STEP_IN or ST_RUNNING)
     debugger.pausereason = "entry"
     local ok, msg = dbgaux.runscript(program, args)
     if not ok then
@@ -245,70 +284,77 @@ end
 
 function reqfuncs.attach(coinfo, req)
     debugger.isattach = true
-    debugger.state = req.arguments.stopOnEntry and ST_STEP_IN or ST_RUNNING
+    debugger.pausereason = "entry"
+    set_output_policy(req.arguments)
+    set_state(req.arguments.stopOnEntry and ST_STEP_IN or ST_RUNNING, coinfo and coinfo.co)
     vscaux.send_response(req.command, req.seq)
 end
 
 function reqfuncs.next(coinfo, req)
-    debugger.state = ST_STEP_OVER
-    coinfo.plevel = coinfo.level
+    set_state(ST_STEP_OVER, get_req_thread(coinfo, req))
     vscaux.send_response(req.command, req.seq)
     return true
 end
 
 function reqfuncs.stepIn(coinfo, req)
-    debugger.state = ST_STEP_IN
-    coinfo.plevel = coinfo.level
+    set_state(ST_STEP_IN, get_req_thread(coinfo, req))
     vscaux.send_response(req.command, req.seq)
     return true
 end
 
 function reqfuncs.stepOut(coinfo, req)
-    debugger.state = ST_STEP_OUT
-    coinfo.plevel = coinfo.level
+    set_state(ST_STEP_OUT, get_req_thread(coinfo, req))
     vscaux.send_response(req.command, req.seq)
     return true
 end
 
 function reqfuncs.continue(coinfo, req)
-    debugger.state = ST_RUNNING
+    set_state(ST_RUNNING)
     vscaux.send_response(req.command, req.seq)
     return true
 end
 
+-- 当前的协程总是在最前面；线程很多时按创建的先后分页，
+-- 可以用参数start和count取后面的页，totalThreads是线程的总数
 function reqfuncs.threads(coinfo, req)
+    local args = req.arguments or {}
+    local threads, total = dbgaux.getthreads(coinfo and coinfo.co, args.start or 0, args.count or THREADS_PAGE)
     vscaux.send_response(req.command, req.seq, {
-        threads = {
-            {id = THREAD_ID, name = "mainthread"},
-        }
+        threads = threads,
+        totalThreads = total,
     })
 end
 
 function reqfuncs.pause(coinfo, req)
-    debugger.state = ST_STEP_IN
+    set_state(ST_STEP_IN, coinfo.co)
     debugger.pausereason = "pause"
-    coinfo.plevel = coinfo.level
     vscaux.send_response(req.command, req.seq)
 end
 
+-- 可以取任何一个挂起的协程的调用栈
 function reqfuncs.stackTrace(coinfo, req)
-    local levels = req.arguments.levels or 20
-    lavels = math.min(levels, 90)
-    local frames = dbgaux.getstackframes(coinfo.co, levels)
-    -- 保存起来
-    vscaux.send_response(req.command, req.seq, {
-        stackFrames = frames,
-        totalFrames = #frames,
-    })
+    local co = dbgaux.getthread(req.arguments.threadId)
+    if not co then
+        vscaux.send_error_response(req.command, req.seq, "thread not found")
+        return
+    end
+    local start = req.arguments.startFrame or 0
+    -- 没有指定或为0时取全部栈帧
+    local levels = req.arguments.levels or 0
+    -- 响应由dbgaux直接编码发出，栈帧ID从lastframe+1开始连续分配，之后的请求通过它找到协程和层级
+    local first = debugger.lastframe + 1
+    local n = dbgaux.sendstacktrace(co, start, levels, first, vscaux.next_seq(), req.seq)
+    for i = 0, n - 1 do
+        new_frame(co, start + i)
+    end
 end
 
 function reqfuncs.scopes(coinfo, req)
-    local function encode_varref(type, frameId)
-        return (type * 100 + frameId) * 10000000
-    end
-
     local frameId = req.arguments.frameId
-    dbgaux.clearvarcache(coinfo.co);
+    if not debugger.frames[frameId] then
+        vscaux.send_error_response(req.command, req.seq, "frameId invalid")
+        return
+    end
     vscaux.send_response(req.command, req.seq, {
         scopes = {
             {
@@ -328,21 +374,32 @@ function reqfuncs.scopes(coinfo, req)
 end
 
 function reqfuncs.variables(coinfo, req)
-    local ok, vars = dbgaux.getvars(coinfo.co, req.arguments.variablesReference)
-    if ok then
-        vscaux.send_response(req.command, req.seq, {
-            variables = vars
-        })
-    else 
-        vscaux.send_error_response(req.command, req.seq, vars)
+    local type, v = decode_varref(req.arguments.variablesReference)
+    local ok, msg
+    if type == 0 then
+        -- 大表给出了indexedVariables和namedVariables，客户端会按indexed和named分页来取
+        local args = req.arguments
+        ok, msg = dbgaux.sendvars(coinfo.co, coinfo.co, 0, 0, v, args.filter, args.start or 0, args.count or 0,
+            vscaux.next_seq(), req.seq)
+    elseif debugger.frames[v] then
+        local frame = debugger.frames[v]
+        ok, msg = dbgaux.sendvars(coinfo.co, frame.co, type, frame.level, 0, nil, 0, 0, vscaux.next_seq(), req.seq)
+    else
+        ok, msg = false, "frameId invalid"
+    end
+    -- 成功时响应已经由dbgaux编码发出了
+    if not ok then
+        vscaux.send_error_response(req.command, req.seq, msg)
     end
 end
 
 function reqfuncs.evaluate(coinfo, req)
     if debugger.state ~= ST_PAUSE then
         vscaux.send_response(req.command, req.seq, {result = ""})
+        return
     end
-    local ok, result = dbgaux.evaluate(coinfo.co, req.arguments.expression, req.arguments.frameId)
+    local frame = debugger.frames[req.arguments.frameId] or {co = coinfo.co, level = 0}
+    local ok, result = dbgaux.evaluate(coinfo.co, frame.co, req.arguments.expression, frame.level)
     if not ok then
         vscaux.send_error_response(req.command, req.seq, result)
     else
@@ -352,11 +409,17 @@ end
 
 function reqfuncs.disconnect(coinfo, req)
     vscaux.send_response(req.command, req.seq)
-    debugger.state = ST_TERMINATED
+    -- 监听模式下只是断开，被调试程序继续运行
+    if debugger.islisten then
+        detach()
+        return true
+    end
+    set_state(ST_TERMINATED)
     vscaux.send_event("output", {
         category = "console",
         output = "Lua Debugger stop!\n",
     })
+    dbgaux.flush()
     os.exit(0)
 end
 
@@ -366,7 +429,16 @@ function on_start()
     debuglog("on_start\n")
 end
 
+-- 进入监听模式
+function on_listen(addr)
+    debugger.islisten = true
+    debuglog("on_listen " .. addr .. "\n")
+end
+
 function on_stop()
+    if debugger.islisten then
+        vscaux.send_event("terminated")
+    end
     vscaux.send_event("output", {
         category = "console",
         output = "Lua Debugger stop!\n",
@@ -377,70 +449,55 @@ function on_stop()
     debuglog("on_stop\n")
 end
 
--- 开始hook一个线程
-function on_new_thread(co)
-    local coinfo = {
-        co = co,        -- 协程
-        pco = nil,      -- 前一个协程
-        level = 0,      -- 当前调用层级
-        plevel = -1,    -- 停下来时的调用层级
-    }
-    debugger.coinfos[co] = coinfo
-    if not debugger.currco then
-        debugger.currco = coinfo
+-- 分发一个请求，返回true表示要继续运行
+local function dispatch_request(req)
+    local func = reqfuncs[req.command]
+    if func then
+        return func(debugger.currco, req)
     end
+    vscaux.send_error_response(req.command, req.seq, string.format("%s not yet implemented", req.command))
 end
 
--- 停止hook一个线程
-function on_free_thread(co)
-    debugger.coinfos[co] = nil
-end
-
--- 恢复一个线程
-function on_resume_thread(co)
-    
-end
-
--- 处理请求
-function handle_request()
+-- 处理请求，co是当前运行的协程，暂停时由on_line设置好了当前协程，不传
+function handle_request(co)
+    if co then
+        debugger.currco = get_coinfo(co)
+    end
     while true do
         if debugger.state == ST_TERMINATED then
             break
         end
-        local req = vscaux.recv_request()
-        if not req or not req.command then
+        local req, closed = vscaux.recv_request(true)
+        if closed then
+            detach()
             break
         end
-        local func = reqfuncs[req.command]
-        if func and func(debugger.currco, req) then
+        if req and req.command and dispatch_request(req) then
             break
-        elseif not func then
-            vscaux.send_error_response(req.command, req.seq, string.format("%s not yet implemented", req.command))
         end
     end
 end
 
--- 调用HOOK
-function on_call(co, source, what, name, line, level)
-    local coinfo = debugger.coinfos[co]
-    if coinfo then
-        coinfo.level = level
-    end
-end
-
--- 返回HOOK
-function on_return(co, source, what, name, line, level)
-    local coinfo = debugger.coinfos[co]
-    if coinfo then
-        coinfo.level = level - 1
+-- 运行中收到了请求：C层在Hook里发现有请求时调用，co是当前运行的协程，只处理已经收到的请求
+function handle_pending(co)
+    debugger.currco = get_coinfo(co)
+    while debugger.state ~= ST_TERMINATED do
+        local req, closed = vscaux.recv_request(false)
+        if closed then
+            detach()
+            break
+        elseif not req then
+            break
+        elseif req.command then
+            dispatch_request(req)
+        end
     end
 end
 
--- 行HOOK
-function on_line(co, source, what, name, line)
-    local coinfo = debugger.coinfos[co]
-    if not coinfo then return end
-    if not check_call_filter(source, what) then return end
+-- 行HOOK：C层判断出断点行或单步应该停下来时才会调用
+function on_line(co, srcid, what, line, isbp, isstep)
+    local coinfo = get_coinfo(co)
+    if not check_call_filter(srcid, what) then return end
 
     local state = debugger.state
     -- 还未运行
@@ -448,72 +505,29 @@ function on_line(co, source, what, name, line)
         return
     end
 
-    -- 记住当前运行的协程
-    debugger.currco = coinfo
-
-    -- 判断断点是否命中
-    if state == ST_RUNNING or state == ST_STEP_OVER or 
-       state == ST_STEP_IN or state == ST_STEP_OUT then
-        local reason;
-        local hit = false
-        if breakpoints_hittest(coinfo, source, line) then     -- 断点命中测试总是在最前面
-            reason = "breakpoint"
-            hit = true
-        elseif state == ST_STEP_OVER then
-            if coinfo.plevel >= coinfo.level then
-                reason = "step"
-                hit = true
-            end
-        elseif state == ST_STEP_OUT then
-            if coinfo.plevel > coinfo.level then
-                reason = "step"
-                hit = true
-            end
-        elseif state == ST_STEP_IN then
+    local reason
+    if isbp then     -- 断点的条件和命中次数已经在C层检查过了，日志断点也在C层输出
+        reason = "breakpoint"
+    elseif isstep then
+        if state == ST_STEP_IN then
             reason = debugger.pausereason or "step"
             debugger.pausereason = "step"
-            hit = true
-        end
-        -- 命中
-        if hit then
-            debugger.state = ST_PAUSE
-            coinfo.plevel = -1
-            vscaux.send_event("stopped", {
-                reason = reason,
-                threadId = THREAD_ID,
-            })
+        else
+            reason = "step"
         end
     end
 
     -- 命中后暂停，获得请求命令
-    if debugger.state == ST_PAUSE then
-        handle_request()
-    end
-end
-
--- 输出事件
-function on_output(str, source, line)
-    debugger.obuffer = debugger.obuffer .. str
-    if source and source:sub(1, 1) == "@" then
-        debugger.osource = source:sub(2)
-    else
-        debugger.osource = source
-    end
-    if not line or line < 0 then
-        debugger.oline = nil
-    else
-        debugger.oline = line
-    end
-    if debugger.obuffer:sub(-1) == '\n' then
-        vscaux.send_event("output", {
-            category = "stdout",
-            output = debugger.obuffer,
-            source = {path = debugger.osource},
-            line = debugger.oline,
+    if reason then
+        -- 记住当前运行的协程
+        debugger.currco = coinfo
+        set_state(ST_PAUSE)
+        vscaux.send_event("stopped", {
+            reason = reason,
+            threadId = dbgaux.getthreadid(co),
+            allThreadsStopped = true,
         })
-        debugger.obuffer = ""
-        debugger.osource = nil
-        debugger.oline = nil
+        handle_request()
     end
 end
 
@@ -138,9 +138,247 @@ local function exec(co, level, func, update, ...)
 	end
 end
 
-return function (source, co, level, ext_funcs)
+local function evaluate(source, co, level, ext_funcs)
 	co = co or coroutine.running()
 	level = level or 0
 	return exec(co, level, wrap_locals(co, source, level, ext_funcs))
 end
 
+-- 条件断点缓存：原型 -> 行 -> 条件 -> 编译好的条件，断点版本改变时清空
+local cond_cache = {}
+local cond_version
+
+local COND_TEMP=[[
+$ARGS
+return function(...)
+$SOURCE
+end
+]]
+
+-- 按栈帧的局部变量和上值编译条件，只编译一次，记下条件函数的每个上值对应的槽位：
+-- slots每4项一组：条件函数的上值索引，名字，局部变量或上值的索引，是否局部变量
+local function compile_condition(co, level, f, source)
+	local names = {}
+	local locals = {}
+	local upvals = {}
+	local i = 1
+	while true do
+		local name = debug.getlocal(co, level, i)
+		if name == nil then
+			break
+		end
+		if name:byte() ~= 40 then	-- '('
+			if not locals[name] then
+				table.insert(names, name)
+			end
+			locals[name] = i	-- 同名的局部变量后面的有效
+		end
+		i = i + 1
+	end
+	local i = 1
+	while true do
+		local name = debug.getupvalue(f, i)
+		if name == nil then
+			break
+		end
+		if name ~= "" and not locals[name] and not upvals[name] then
+			table.insert(names, name)
+			upvals[name] = i
+		end
+		i = i + 1
+	end
+
+	temp.ARGS = #names > 0 and "local " .. table.concat(names, ",") or ""
+	-- 先当表达式编译，不行再当语句编译
+	temp.SOURCE = "return " .. source
+	local isstmt = false
+	local loader, err = load(COND_TEMP:gsub("%$(%w+)", temp), "=(condition)")
+	if loader == nil then
+		temp.SOURCE = source
+		isstmt = true
+		loader, err = load(COND_TEMP:gsub("%$(%w+)", temp), "=(condition)")
+		if loader == nil then
+			return nil, err
+		end
+	end
+	local func = loader()
+
+	local slots = {}
+	local i = 1
+	while true do
+		local name = debug.getupvalue(func, i)
+		if name == nil then
+			break
+		end
+		local n = #slots
+		if locals[name] then
+			slots[n+1], slots[n+2], slots[n+3], slots[n+4] = i, name, locals[name], true
+		elseif upvals[name] then
+			slots[n+1], slots[n+2], slots[n+3], slots[n+4] = i, name, upvals[name], false
+		end
+		i = i + 1
+	end
+	return {
+		func = func,
+		slots = slots,
+		isstmt = isstmt,
+		isvararg = debug.getinfo(f, "u").isvararg,
+	}
+end
+
+-- 把条件重新绑定到当前栈帧，局部变量或上值对不上时返回false
+local function bind_condition(c, co, level, f)
+	local func, slots = c.func, c.slots
+	for k = 1, #slots, 4 do
+		if slots[k+3] then
+			local name, value = debug.getlocal(co, level, slots[k+2])
+			if name ~= slots[k+1] then
+				return false
+			end
+			debug.setupvalue(func, slots[k], value)
+		else
+			if debug.getupvalue(f, slots[k+2]) ~= slots[k+1] then
+				return false
+			end
+			debug.upvaluejoin(func, slots[k], f, slots[k+2])
+		end
+	end
+	return true
+end
+
+local function get_varargs(co, level)
+	local vargs = {}
+	local i = 1
+	while true do
+		local vararg, v = debug.getlocal(co, level, -i)
+		if not vararg then
+			break
+		end
+		vargs[i] = v
+		i = i + 1
+	end
+	vargs.n = i - 1
+	return vargs
+end
+
+-- 取编译好并绑定到栈帧的表达式，key是函数原型，f是栈帧的函数，
+-- level是condition和logmessage直接调用的辅助函数看到的栈帧层级
+local function get_compiled(version, key, line, source, f, co, level)
+	if co == coroutine.running() then
+		level = level + 1	-- 下面的辅助函数比这里多一层
+	end
+	if cond_version ~= version then
+		cond_cache = {}
+		cond_version = version
+	end
+	local lines = cond_cache[key]
+	if not lines then
+		lines = {}
+		cond_cache[key] = lines
+	end
+	local conds = lines[line]
+	if not conds then
+		conds = {}
+		lines[line] = conds
+	end
+
+	local c = conds[source]
+	if not c or not bind_condition(c, co, level, f) then
+		local err
+		c, err = compile_condition(co, level, f, source)
+		if not c then
+			return nil, err
+		end
+		conds[source] = c
+		bind_condition(c, co, level, f)
+	end
+	return c
+end
+
+local function call_compiled(c, vargs)
+	if vargs then
+		return pcall(c.func, table.unpack(vargs, 1, vargs.n))
+	else
+		return pcall(c.func)
+	end
+end
+
+-- 检查条件断点，返回是否求值成功和条件是否成立
+local function condition(version, key, line, source, f, co, level)
+	co = co or coroutine.running()
+	level = level or 0
+	if co == coroutine.running() then
+		level = level + 3	-- 辅助函数，condition，栈帧
+	end
+	local c, err = get_compiled(version, key, line, source, f, co, level)
+	if not c then
+		return false, err
+	end
+	local ok, res = call_compiled(c, c.isvararg and get_varargs(co, level))
+	if not ok then
+		return false, res
+	end
+	return true, c.isstmt or (res ~= nil and res ~= false)
+end
+
+-- 日志断点的消息拆成文本和{表达式}，按消息缓存
+local log_cache = {}
+local function parse_logmessage(msg)
+	local parts = log_cache[msg]
+	if parts then
+		return parts
+	end
+	parts = {}
+	local pos = 1
+	while true do
+		local s, e, expr = msg:find("{([^{}]+)}", pos)
+		if not s then
+			break
+		end
+		if s > pos then
+			table.insert(parts, {text = msg:sub(pos, s - 1)})
+		end
+		table.insert(parts, {expr = expr})
+		pos = e + 1
+	end
+	if pos <= #msg then
+		table.insert(parts, {text = msg:sub(pos)})
+	end
+	log_cache[msg] = parts
+	return parts
+end
+
+-- 生成日志断点的消息，{}里的表达式和条件一样编译一次，之后只重新绑定
+local function logmessage(version, key, line, msg, f, co, level)
+	co = co or coroutine.running()
+	level = level or 0
+	if co == coroutine.running() then
+		level = level + 3	-- 辅助函数，logmessage，栈帧
+	end
+	local parts = parse_logmessage(msg)
+	local out = {}
+	local vargs
+	for i, part in ipairs(parts) do
+		if part.text then
+			out[i] = part.text
+		else
+			local c, err = get_compiled(version, key, line, part.expr, f, co, level)
+			if c then
+				if c.isvararg and not vargs then
+					vargs = get_varargs(co, level)
+				end
+				local ok, res = call_compiled(c, c.isvararg and vargs)
+				out[i] = ok and tostring(res) or ("<" .. tostring(res) .. ">")
+			else
+				out[i] = "<" .. tostring(err) .. ">"
+			end
+		end
+	end
+	return table.concat(out)
+end
+
+return {
+	evaluate = evaluate,
+	condition = condition,
+	logmessage = logmessage,
+}
@@ -0,0 +1,95 @@
+--[[
+    调试器性能测试，用test.lua类似的负载测量各种调试状态下的吞吐量
+    用法：用launch.json里的"vsclua bench"配置启动
+      - 不设断点：运行状态无断点的开销
+      - 在usage那一行设断点：有断点，但热点函数里没有断点的开销
+      - 在loop()的never那一行设断点：热点函数里有断点的开销
+      - 在run()那一行设断点，命中后单步跳过：单步状态的开销
+]]
+local N = tonumber((...)) or 1
+if N <= 0 then
+    print("usage: bench.lua [times]")
+    return
+end
+
+local function fib(n)
+    if n < 2 then return n end
+    return fib(n - 1) + fib(n - 2)
+end
+
+local function loop(n)
+    local s = 0
+    for i = 1, n do
+        s = s + i % 7
+    end
+    if s < 0 then
+        print("never")
+    end
+    return s
+end
+
+local function tables(n)
+    local t = {}
+    for i = 1, n do
+        t[i] = {name = "tom", age = i}
+    end
+    local s = 0
+    for _, v in ipairs(t) do
+        s = s + v.age
+    end
+    return s
+end
+
+local function strings(n)
+    local t = {}
+    for i = 1, n do
+        t[#t+1] = string.format("%d:%s", i, "abc")
+    end
+    return #table.concat(t, ",")
+end
+
+local function coroutines(n)
+    local co = coroutine.wrap(function()
+        while true do
+            coroutine.yield(1)
+        end
+    end)
+    local s = 0
+    for i = 1, n do
+        s = s + co()
+    end
+    return s
+end
+
+local cases = {
+    {"fib", fib, 25},
+    {"loop", loop, 3000000},
+    {"tables", tables, 300000},
+    {"strings", strings, 300000},
+    {"coroutines", coroutines, 300000},
+}
+
+local function mark()
+    return os.clock()
+end
+
+local function run_case(name, f, n)
+    local t0 = mark()
+    for _ = 1, N do
+        f(n)
+    end
+    return mark() - t0
+end
+
+local function run()
+    local total = 0
+    for _, c in ipairs(cases) do
+        local name, f, n = c[1], c[2], c[3]
+        local dt = run_case(name, f, n)
+        total = total + dt
+        print(string.format("%-12s %8.3fs", name, dt))
+    end
+    print(string.format("%-12s %8.3fs", "total", total))
+end
+
+run()
@@ -0,0 +1,57 @@
+--[[
+    条件断点性能测试，测量每次命中时求值条件的开销
+    用法：用launch.json里的"vsclua bench cond"配置启动
+      - 在native()的count那一行设条件断点 i == -1，这个条件在C层直接求值
+      - 在compiled()的count那一行设条件断点 i + 0 == -1，这个条件交给调试器脚本编译求值
+      - base()那一行不设断点，作为基准
+    输出每次循环的耗时，减去base的耗时就是每次命中求值条件的开销
+]]
+local N = tonumber((...)) or 1000000
+if N <= 0 then
+    print("usage: bench_cond.lua [times]")
+    return
+end
+
+local function base(n)
+    local count = 0
+    for i = 1, n do
+        count = count + 1
+    end
+    return count
+end
+
+local function native(n)
+    local count = 0
+    for i = 1, n do
+        count = count + 1
+    end
+    return count
+end
+
+local function compiled(n)
+    local count = 0
+    for i = 1, n do
+        count = count + 1
+    end
+    return count
+end
+
+local cases = {
+    {"base", base},
+    {"native", native},
+    {"compiled", compiled},
+}
+
+local function run()
+    local basetime
+    for _, c in ipairs(cases) do
+        local name, f = c[1], c[2]
+        local t0 = os.clock()
+        f(N)
+        local dt = (os.clock() - t0) / N * 1e9
+        basetime = basetime or dt
+        print(string.format("%-10s %10.1fns/loop %10.1fns/cond", name, dt, dt - basetime))
+    end
+end
+
+run()
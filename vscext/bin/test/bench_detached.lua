@@ -0,0 +1,74 @@
+--[[
+    监听模式下没有客户端连着时的开销测试，和不挂调试器的lua对比
+    用法：
+      lua bench_detached.lua [times]
+      vscluadbg -listen 4711 bench_detached.lua [times]
+    两者每一项的耗时应该相差不到1%；中途用"vsclua attach"配置连上来再断开，
+    断开后的耗时也应该回到原来的水平
+]]
+local N = tonumber((...)) or 3
+if N <= 0 then
+    print("usage: bench_detached.lua [times]")
+    return
+end
+
+local function fib(n)
+    if n < 2 then return n end
+    return fib(n - 1) + fib(n - 2)
+end
+
+local function loop(n)
+    local s = 0
+    for i = 1, n do
+        s = s + i % 7
+    end
+    return s
+end
+
+local function strings(n)
+    local t, len = {}, 0
+    for i = 1, n do
+        t[#t+1] = tostring(i)
+        if #t == 100 then
+            len = len + #table.concat(t, ",")
+            t = {}
+        end
+    end
+    return len
+end
+
+local function coroutines(n)
+    local co = coroutine.wrap(function()
+        while true do coroutine.yield(1) end
+    end)
+    local s = 0
+    for i = 1, n do
+        s = s + co()
+    end
+    for i = 1, n // 100 do
+        coroutine.wrap(function() s = s + 1 end)()
+    end
+    return s
+end
+
+local cases = {
+    {"fib", fib, 32},
+    {"loop", loop, 30000000},
+    {"strings", strings, 3000000},
+    {"coroutines", coroutines, 3000000},
+}
+
+local total = 0
+for _, c in ipairs(cases) do
+    local name, f, n = c[1], c[2], c[3]
+    local best
+    for i = 1, N do
+        local t0 = os.clock()
+        f(n)
+        local dt = os.clock() - t0
+        best = best and math.min(best, dt) or dt
+    end
+    total = total + best
+    print(string.format("%-12s %8.3fs", name, best))
+end
+print(string.format("%-12s %8.3fs", "total", total))
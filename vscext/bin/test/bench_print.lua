@@ -0,0 +1,18 @@
+--[[
+    print输出到VSCode的开销测试
+    用法：在VSCode里用launch配置运行(program指向这个文件，args可以给行数)
+      bench_print.lua [lines]
+    最后输出打印这么多行的耗时
+]]
+local N = tonumber((...)) or 1000000
+if N <= 0 then
+    print("usage: bench_print.lua [lines]")
+    return
+end
+
+local t0 = os.clock()
+for i = 1, N do
+    print("line", i)
+end
+local dt = os.clock() - t0
+print(string.format("print %d lines: %.3fs", N, dt))
@@ -0,0 +1,23 @@
+--[[
+    缓冲的输出按时发出的测试
+    用法：在VSCode里用launch配置运行(program指向这个文件)，可以在第20行设一个日志断点
+    print之后马上阻塞在C函数里，不会再进Hook，缓冲里的输出要由定时线程在50ms左右发出：
+    "line 2"、"line 3"和日志应该马上出现在调试控制台，而不是等2秒后和"after sleep"一起出现
+]]
+local sec = tonumber((...)) or 2
+
+-- 同一行连续输出的会合并，第一行马上发出，后两行留在缓冲里
+for i = 1, 3 do print("line", i) end
+os.execute("sleep " .. sec)
+print("after sleep")
+
+-- 日志断点也一样，每个位置的日志单独发出，带着各自的行号
+local function work(n)
+    local x = n * 2
+    return x
+end
+for i = 1, 3 do
+    work(i)     -- 日志断点：work {i}
+end
+os.execute("sleep " .. sec)
+print("done")
@@ -3,30 +3,30 @@
     by colin
 ]]
 local cjson = require "cjson"
+local dbgaux = require "dbgaux"
 local vscaux = {}
-local seq = 0
 
--- 发送消息
+-- 发送消息，消息由C层缓冲，一批消息合并发出；
+-- cjson直接编码成带Content-Length头的帧交给C层，不生成中间的字符串
 function vscaux.send(msg)
-    local output = io.stdout
-    local ok, content = pcall(cjson.encode, msg)
+    local ok, frame, len = pcall(cjson.encode_frame, msg)
     if ok then
-        local data = string.format("Content-Length: %s\r\n\r\n%s\n", #content, content)
-        debuglog(data)
-        if output:write(data) then
-            output:flush()
-            return true
-        end
+        dbgaux.sendframe(frame, len)
+        return true
     else
-        debuglog(content)
+        debuglog(frame)
     end
 end
 
+-- 分配一个消息序号，序号由C层分配，和捕获输出的线程发出的事件共用一个计数
+function vscaux.next_seq()
+    return dbgaux.nextseq()
+end
+
 -- 发送事件
 function vscaux.send_event(event, body)
-    seq = seq + 1
     local res = {
-        seq = seq,
+        seq = vscaux.next_seq(),
         type = "event",
         event = event,
         body = body,
@@ -34,45 +34,27 @@ function vscaux.send_event(event, body)
     return vscaux.send(res)
 end
 
--- 获得请求
-function vscaux.recv_request()
-    local input = io.stdin
-    local header = input:read()
-    debuglog(header)
-    if header:find("Content-Length: ", 1, true) then
-        local rd = input:read()
-        debuglog(rd)
-        if rd then
-            local len = tonumber(header:match("(%d+)"))
-            local sreq = input:read(len)
-            debuglog(sreq)
-            if sreq then
-                local ok, req = pcall(cjson.decode, sreq)
-                if ok then
-                    debuglog("\n")
-                    return req
-                else
-                    debuglog(req)
-                end
-            end
+-- 获得请求，请求由C层的读线程读取并分帧；block为false时没有请求马上返回nil；
+-- 客户端断开时返回nil, true
+function vscaux.recv_request(block)
+    local sreq, closed = dbgaux.recv(block)
+    if sreq then
+        debuglog(sreq)
+        local ok, req = pcall(cjson.decode, sreq)
+        if ok then
+            debuglog("\n")
+            return req
+        else
+            debuglog(req)
         end
     end
-
-    -- TODO 简化测试
-    -- local msg = input:read()
-    -- local ok, req = pcall(cjson.decode, msg)
-    -- if ok then
-    --     return req
-    -- else
-    --     print(req)
-    -- end
+    return nil, closed
 end
 
 -- 发送响应
 function vscaux.send_response(cmd, rseq, body)
-    seq = seq + 1
     local res = {
-        seq = seq,
+        seq = vscaux.next_seq(),
         type = "response",
         success = true,
         request_seq = rseq,
@@ -84,9 +66,8 @@ end
 
 -- 错误响应
 function vscaux.send_error_response(cmd, rseq, msg)
-    seq = seq + 1
     local res = {
-        seq = seq,
+        seq = vscaux.next_seq(),
         type = "response",
         success = false,
         request_seq = rseq,